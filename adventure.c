@@ -42,10 +42,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <linux/tty.h>
+#include "arena.h"
 #include "assert.h"
 #include "input.h"
 #include "modex.h"
@@ -75,6 +80,30 @@ volatile unsigned long flagger;
 #define TICK_USEC      50000 /* tick length in microseconds          */
 #define STATUS_MSG_LEN 40    /* maximum length of status message     */
 #define MOTION_SPEED   2     /* pixels moved per command             */
+#define FRAME_USEC     16667 /* shortest time between frames (60 Hz) */
+#define MAX_EVENTS     8     /* most events taken from one epoll_wait */
+
+/* 
+ * The tick rate adapts to what is happening.  While a direction is held
+ * on the Tux controller, ticks come every FAST_TICK_USEC, and the view
+ * moves MOTION_SPEED pixels per TICK_USEC of ticks (0, 1, and 1 pixels
+ * on successive ticks), so scrolling is smooth but no faster.  Otherwise, 
+ * ticks come every IDLE_TICK_USEC--but the buttons are read on ticks
+ * unless TUX_POLL is 1, so with a Tux controller attached, every 
+ * TICK_USEC.  The Tux clock is updated on each second whatever the
+ * tick rate.
+ */
+#define FAST_TICK_USEC 16667
+#define IDLE_TICK_USEC 250000
+
+/* 
+ * Set TUX_POLL to 1 once the Tux controller driver supports poll, so
+ * that button presses are handled as soon as they arrive.  Until then,
+ * the buttons are read once per tick.
+ */
+#if !defined(TUX_POLL)
+#define TUX_POLL 0
+#endif
 
 /* outcome of the game */
 typedef enum {GAME_WON, GAME_QUIT} game_condition_t;
@@ -154,7 +183,14 @@ static void move_photo_right (void);
 static void move_photo_up (void);
 static void redraw_room (void);
 static void* status_thread (void* ignore);
-static int time_is_after (struct timeval* t1, struct timeval* t2);
+static int time_is_after (struct timespec* t1, struct timespec* t2);
+static void advance_time (struct timespec* t, int32_t usec);
+static int msec_until (const struct timespec* now, const struct timespec* t);
+static void start_ticks (const struct timespec* first, int32_t usec);
+static int watch_fd (int epoll_fd, int wfd);
+static void loop_panic (const char* what);
+static void signal_status (void);
+static int32_t do_command (cmd_t c, int32_t* enter_room);
 
 
 
@@ -162,6 +198,20 @@ static int time_is_after (struct timeval* t1, struct timeval* t2);
 
 static game_info_t game_info; /* game information */
 
+/* 
+ * The event loop ticks are driven by a periodic CLOCK_MONOTONIC timer
+ * read through tick_fd, or, if the timer can't be created (tick_fd is 
+ * -1), by sleeping in epoll_wait until each tick.  Either way, the loop
+ * sleeps between ticks rather than polling the clock.
+ */
+static int tick_fd = -1;
+
+/* a Tux controller answered TUX_INIT */
+static int tux_present;
+
+/* eventfd written whenever status_msg changes (see signal_status) */
+static int status_fd = -1;
+
 
 /* 
  * The variables below are used to keep track of the status message helper
@@ -212,7 +262,11 @@ cancel_button_thread (void* ignore)
 
 /* 
  * game_loop
- *   DESCRIPTION: Main event loop for the adventure game.
+ *   DESCRIPTION: Main event loop for the adventure game.  The loop sleeps
+ *                in epoll_wait until input arrives, a status message
+ *                changes, or a tick passes.  Commands are carried out as
+ *                soon as they arrive, and the screen is shown whenever it
+ *                has changed, but no more often than once per FRAME_USEC.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: GAME_QUIT if the player quits, or GAME_WON if they have won
@@ -225,173 +279,318 @@ game_loop ()
      * Variables used to carry information between event loop ticks; see
      * initialization below for explanations of purpose.
      */
-    struct timeval start_time, tick_time;
-
-    struct timeval cur_time; /* current time (during tick)      */
-                        /* command issued by input control */
-    int32_t enter_room;      /* player has changed rooms        */
+    struct timespec start_time, tick_time, frame_time, clock_time;
+
+    struct timespec cur_time;  /* current time (during tick)       */
+    struct epoll_event ev[MAX_EVENTS]; /* events ready             */
+    game_condition_t result;   /* outcome of the game              */
+    int      epoll_fd;         /* epoll instance for events        */
+    int      stdin_polled;     /* stdin is watched by epoll_fd     */
+    int      timeout;          /* milliseconds to wait for events  */
+    int      num_ev;           /* number of events ready           */
+    int      i;                /* index over events                */
+    int32_t  enter_room;       /* player has changed rooms         */
+    int32_t  dirty;            /* screen changed since last shown  */
+    int32_t  tick;             /* a tick has passed                */
+    int32_t  input;            /* stdin has input to read          */
+    int32_t  buttons;          /* Tux controller has input to read */
+    uint32_t old_width;        /* room photo size before reloads   */
+    uint32_t old_height;
+    uint64_t count;            /* ticks or messages since last read */
+    int32_t  tick_usec;        /* current time between ticks       */
+    int32_t  idle_usec;        /* time between ticks when idle     */
+    int32_t  held;             /* a direction is held on the Tux   */
+    int32_t  motion;           /* motion owed, in TICK_USEC pixels */
 
     /* Record the starting time--assume success. */
-    (void)gettimeofday (&start_time, NULL);
+    (void)clock_gettime (CLOCK_MONOTONIC, &start_time);
+    cur_time = start_time;
 
-    /* Calculate the time at which the first event loop tick should occur. */
+    /* The first frame can be shown at once; the clock changes in 1 s. */
+    frame_time = start_time;
+    clock_time = start_time;
+    clock_time.tv_sec++;
+
+    /* 
+     * Calculate the time at which the first event loop tick should occur.
+     * Ticks start at the idle rate.
+     */
+    idle_usec = (TUX_POLL || !tux_present ? IDLE_TICK_USEC : TICK_USEC);
+    tick_usec = idle_usec;
+    held = motion = 0;
     tick_time = start_time;
-    if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
-    tick_time.tv_sec++;
-    tick_time.tv_usec -= 1000000;
+    advance_time (&tick_time, tick_usec);
+    tick_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC);
+    start_ticks (&tick_time, tick_usec);
+
+    /* Watch for input, ticks, and status messages. */
+    if (-1 == (epoll_fd = epoll_create1 (EPOLL_CLOEXEC))) {
+        loop_panic ("epoll_create1");
     }
+    stdin_polled = watch_fd (epoll_fd, fileno (stdin));
+    (void)watch_fd (epoll_fd, tick_fd);
+    (void)watch_fd (epoll_fd, status_fd);
+#if (1 == TUX_POLL)
+    (void)watch_fd (epoll_fd, fd);
+#endif
 
     /* The player has just entered the first room. */
     enter_room = 1;
+    dirty = 1;
 
     /* The main event loop. */
     while (1) {
-    /* 
-     * Update the screen, preparing the VGA palette and photo-drawing
-     * routines and drawing a new room photo first if the player has
-     * entered a new room, then showing the screen (and status bar,
-     * once you have it working).
-     */
-    if (enter_room) {
-        /* Reset the view window to (0,0). */
-        game_info.map_x = game_info.map_y = 0;
-        set_view_window (game_info.map_x, game_info.map_y);
-
-        /* Discard any partially-typed command. */
-        reset_typed_command ();
-        
-        /* Adjust colors and photo drawing for the current room photo. */
-        prep_room (game_info.where);
+	/* 
+	 * Prepare the VGA palette and photo-drawing routines and draw a
+	 * new room photo if the player has entered a new room.
+	 */
+	if (enter_room) {
+	    /* Reset the view window to (0,0). */
+	    game_info.map_x = game_info.map_y = 0;
+	    set_view_window (game_info.map_x, game_info.map_y);
+
+	    /* Discard any partially-typed command. */
+	    reset_typed_command ();
+	    
+	    /* Adjust colors and photo drawing for the current room photo. */
+	    prep_room (game_info.where);
+
+	    /* Draw the room (calls show. */
+	    redraw_room ();
+
+	    /* Only draw once on entry. */
+	    enter_room = 0;
+	    dirty = 1;
+	}
 
-        /* Draw the room (calls show. */
-        redraw_room ();
+	/* 
+	 * Show the screen and status bar if anything has changed, unless
+	 * the last frame was shown less than FRAME_USEC ago.
+	 */
+	(void)clock_gettime (CLOCK_MONOTONIC, &cur_time);
+	if (dirty && time_is_after (&cur_time, &frame_time)) {
+	    show_screen ();
+
+	    //calling the function i make in modex.c here!
+	    (void)pthread_mutex_lock(&msg_lock); //lock
+	    draw_status (status_msg, room_name(game_info.where), 
+	    		 get_typed_command());
+	    (void)pthread_mutex_unlock(&msg_lock); //unlock
+
+	    display_time_on_tux(cur_time.tv_sec - start_time.tv_sec -
+	    			(cur_time.tv_nsec < start_time.tv_nsec)); //GAME TIME DISPLAY CALL
+
+	    frame_time = cur_time;
+	    advance_time (&frame_time, FRAME_USEC);
+	    dirty = 0;
+	}
 
-        /* Only draw once on entry. */
-        enter_room = 0;
-    }
+	/*
+	 * Wait for an event: input, a status message, or a tick.  The tick
+	 * defines the basic timing of our event loop.  If the screen is 
+	 * waiting to be shown, wait no longer than until it can be, and if
+	 * there is no tick timer, no longer than until the next tick.
+	 */
+	timeout = (dirty ? msec_until (&cur_time, &frame_time) : 
+		   msec_until (&cur_time, &clock_time));
+	if (-1 == tick_fd && 
+	    (-1 == timeout || msec_until (&cur_time, &tick_time) < timeout)) {
+	    timeout = msec_until (&cur_time, &tick_time);
+	}
+	if (0 > (num_ev = epoll_wait (epoll_fd, ev, MAX_EVENTS, timeout))) {
+	    if (EINTR != errno) {
+		loop_panic ("epoll_wait");
+	    }
+	    num_ev = 0;
+	}
+	tick = input = buttons = 0;
+	for (i = 0; num_ev > i; i++) {
+	    if (tick_fd == ev[i].data.fd) {
+		/* 
+		 * A read returns the number of ticks since the last one,
+		 * so ticks missed completely are skipped.
+		 */
+		tick = (sizeof (count) == read (tick_fd, &count, 
+						sizeof (count)));
+	    } else if (status_fd == ev[i].data.fd) {
+		(void)read (status_fd, &count, sizeof (count));
+		dirty = 1;
+	    } else if (fileno (stdin) == ev[i].data.fd) {
+		input = 1;
+	    } else {
+	        /* the Tux controller (see TUX_POLL) */
+		buttons = 1;
+	    }
+	}
 
-    show_screen ();
+	/*
+	 * Without the tick timer, advance the tick time.  If we missed one
+	 * or more ticks completely, i.e., if the current time is already 
+	 * after the time for the next tick, just skip the extra ticks and
+	 * advance the clock to the one that we haven't missed.
+	 */
+	(void)clock_gettime (CLOCK_MONOTONIC, &cur_time);
+	if (-1 == tick_fd && time_is_after (&cur_time, &tick_time)) {
+	    tick = 1;
+	    do {
+		advance_time (&tick_time, tick_usec);
+	    } while (time_is_after (&cur_time, &tick_time));
+	}
 
-    //calling the function i make in modex.c here!
-    (void)pthread_mutex_lock(&msg_lock); //lock
-    draw_status (status_msg, room_name(game_info.where), get_typed_command());
-    (void)pthread_mutex_unlock(&msg_lock); //unlock
+	/* Show the Tux clock when its second changes. */
+	if (time_is_after (&cur_time, &clock_time)) {
+	    dirty = 1;
+	    clock_time.tv_sec = start_time.tv_sec + 1 +
+	        (cur_time.tv_sec - start_time.tv_sec - 
+		 (cur_time.tv_nsec < start_time.tv_nsec));
+	}
 
-    display_time_on_tux(cur_time.tv_sec - start_time.tv_sec); //GAME TIME DISPLAY CALL
-    
-    /*
-     * Wait for tick.  The tick defines the basic timing of our
-     * event loop, and is the minimum amount of time between events.
-     */
-    do {
-        if (gettimeofday (&cur_time, NULL) != 0) {
-        /* Panic!  (should never happen) */
-        clear_mode_X ();
-        shutdown_input ();
-        perror ("gettimeofday");
-        exit (3);
-        }
-    } while (!time_is_after (&cur_time, &tick_time));
+	/* 
+	 * Handle synchronous events--in this case, only player commands. 
+	 * Commands are carried out as soon as they arrive (or on each tick
+	 * if stdin can't be watched).  Note that typed commands that move
+	 * objects may cause the room to be redrawn.
+	 */
+	if (input || (tick && !stdin_polled)) {
+	    cmd = get_command();
+	    if (do_command (cmd, &enter_room)) {
+		result = GAME_QUIT;
+		break;
+	    }
+	    dirty = 1;
+	}
 
-    /*
-     * Advance the tick time.  If we missed one or more ticks completely, 
-     * i.e., if the current time is already after the time for the next 
-     * tick, just skip the extra ticks and advance the clock to the one
-     * that we haven't missed.
-     */
-    do {
-        if ((tick_time.tv_usec += TICK_USEC) > 1000000) {
-        tick_time.tv_sec++;
-        tick_time.tv_usec -= 1000000;
-        }
-    } while (time_is_after (&cur_time, &tick_time));
+	/* If player wins the game, their room becomes NULL. */
+	if (NULL == game_info.where) {
+	    result = GAME_WON;
+	    break;
+	}
+	if (!tick && !buttons) {
+	    continue;
+	}
 
-    /*
-     * Handle asynchronous events.  These events use real time rather
-     * than tick counts for timing, although the real time is rounded
-     * off to the nearest tick by definition.
-     */
-    /* (none right now...) */
+	/*
+	 * Handle asynchronous events.  These events use real time rather
+	 * than tick counts for timing, although the real time is rounded
+	 * off to the nearest tick by definition.
+	 */
+
+	/* 
+	 * Swap in room photos changed on disk (in hot reload mode) and 
+	 * free photos thrown out.  If the current room's photo changed, 
+	 * show it, starting over at (0,0) if its size changed.
+	 */
+	old_width = room_photo_width (game_info.where);
+	old_height = room_photo_height (game_info.where);
+	if (tick && apply_photo_reloads (game_info.where)) {
+	    if (old_width != room_photo_width (game_info.where) ||
+		old_height != room_photo_height (game_info.where)) {
+		game_info.map_x = game_info.map_y = 0;
+		set_view_window (game_info.map_x, game_info.map_y);
+	    }
+	    prep_room (game_info.where);
+	    redraw_room ();
+	    dirty = 1;
+	}
 
-    /* 
-     * Handle synchronous events--in this case, only player commands. 
-     * Note that typed commands that move objects may cause the room
-     * to be redrawn.
-     */
-    
-    // replicate similar button press logic --SYNC
-	cmd = get_command();
-    switch (cmd) {
-        case CMD_UP:    move_photo_down ();  break;
-        case CMD_RIGHT: move_photo_left ();  break;
-        case CMD_DOWN:  move_photo_up ();    break;
-        case CMD_LEFT:  move_photo_right (); break;
-        case CMD_MOVE_LEFT:   
-        enter_room = (TC_CHANGE_ROOM == 
-                  try_to_move_left (&game_info.where));
-        break;
-        case CMD_ENTER:
-        enter_room = (TC_CHANGE_ROOM ==
-                  try_to_enter (&game_info.where));
-        break;
-        case CMD_MOVE_RIGHT:
-        enter_room = (TC_CHANGE_ROOM == 
-                  try_to_move_right (&game_info.where));
-        break;
-        case CMD_TYPED:
-        if (handle_typing ()) {
-            enter_room = 1;
-        }
-        break;
-        case CMD_QUIT: return GAME_QUIT;
-        default: break;
-        }
-    
-    tux_cmd = tux_command(btns,flagger);
-    flagger = btns;
-    ioctl(fd,TUX_BUTTONS,&btns);
-	
-    pthread_mutex_lock(&button_msg_lock);
+	// replicate similar button press logic --SYNC
+	tux_cmd = tux_command(btns,flagger);
+	flagger = btns;
+	ioctl(fd,TUX_BUTTONS,&btns);
+	    
+	pthread_mutex_lock(&button_msg_lock);
 	if(btns != 0xFF){
-		button_press = 1; //active set 
+	    button_press = 1; //active set 
 	}else{
-		button_press = 0; //no press
+	    button_press = 0; //no press
 	}
-    if(button_press){
-		pthread_cond_signal(&button_msg_cv);
+	if(button_press){
+	    pthread_cond_signal(&button_msg_cv);
 	}
-    pthread_mutex_unlock(&button_msg_lock);
-    switch (tux_cmd) {
-        case CMD_UP:    move_photo_down ();  break;
-        case CMD_RIGHT: move_photo_left ();  break;
-        case CMD_DOWN:  move_photo_up ();    break;
-        case CMD_LEFT:  move_photo_right (); break;
-        case CMD_MOVE_LEFT:   
-        enter_room = (TC_CHANGE_ROOM == 
-                  try_to_move_left (&game_info.where));
-        break;
-        case CMD_ENTER:
-        enter_room = (TC_CHANGE_ROOM ==
-                  try_to_enter (&game_info.where));
-        break;
-        case CMD_MOVE_RIGHT:
-        enter_room = (TC_CHANGE_ROOM == 
-                  try_to_move_right (&game_info.where));
-        break;
-        case CMD_TYPED:
-        if (handle_typing ()) {
-            enter_room = 1;
-        }
-        break;
-        case CMD_QUIT: return GAME_QUIT;
-        default: break;
-        }
+	pthread_mutex_unlock(&button_msg_lock);
 
-    /* If player wins the game, their room becomes NULL. */
-    if (NULL == game_info.where) {
-        return GAME_WON;
-    }
+	/* 
+	 * A held direction moves the view MOTION_SPEED pixels per TICK_USEC
+	 * of ticks, whatever the tick rate.  At FAST_TICK_USEC, that is 0,
+	 * 1, and 1 pixels on successive ticks; a tick that moves no pixels
+	 * does nothing, and leaves the screen as it is.
+	 */
+	held = (CMD_UP == tux_cmd || CMD_DOWN == tux_cmd ||
+		CMD_LEFT == tux_cmd || CMD_RIGHT == tux_cmd);
+	if (held && tick) {
+	    motion += tick_usec * MOTION_SPEED;
+	    game_info.x_speed = game_info.y_speed = motion / TICK_USEC;
+	    motion -= game_info.x_speed * TICK_USEC;
+	} else if (!held) {
+	    motion = 0;
+	}
+	if (held ? (tick && 0 != game_info.x_speed) : CMD_NONE != tux_cmd) {
+	    if (do_command (tux_cmd, &enter_room)) {
+		result = GAME_QUIT;
+		break;
+	    }
+	    dirty = 1;
+	}
+	game_info.x_speed = game_info.y_speed = MOTION_SPEED;
+
+	/* Tick quickly while a direction is held, and slowly otherwise. */
+	if ((held ? FAST_TICK_USEC : idle_usec) != tick_usec) {
+	    tick_usec = (held ? FAST_TICK_USEC : idle_usec);
+	    tick_time = cur_time;
+	    advance_time (&tick_time, tick_usec);
+	    start_ticks (&tick_time, tick_usec);
+	}
+
+	/* If player wins the game, their room becomes NULL. */
+	if (NULL == game_info.where) {
+	    result = GAME_WON;
+	    break;
+	}
     } /* end of the main event loop */
+
+    (void)close (epoll_fd);
+    return result;
+}
+
+
+/* 
+ * do_command
+ *   DESCRIPTION: Carry out a command from the keyboard or Tux controller.
+ *   INPUTS: c -- the command
+ *   OUTPUTS: enter_room -- set to 1 if the player changes rooms
+ *   RETURN VALUE: 1 if the player quits, 0 otherwise
+ *   SIDE EFFECTS: may move the view window or the player, and may redraw
+ *                 the screen
+ */
+static int32_t
+do_command (cmd_t c, int32_t* enter_room)
+{
+    switch (c) {
+	case CMD_UP:    move_photo_down ();  break;
+	case CMD_RIGHT: move_photo_left ();  break;
+	case CMD_DOWN:  move_photo_up ();    break;
+	case CMD_LEFT:  move_photo_right (); break;
+	case CMD_MOVE_LEFT:   
+	    *enter_room = (TC_CHANGE_ROOM == 
+			   try_to_move_left (&game_info.where));
+	    break;
+	case CMD_ENTER:
+	    *enter_room = (TC_CHANGE_ROOM ==
+			   try_to_enter (&game_info.where));
+	    break;
+	case CMD_MOVE_RIGHT:
+	    *enter_room = (TC_CHANGE_ROOM == 
+			   try_to_move_right (&game_info.where));
+	    break;
+	case CMD_TYPED:
+	    if (handle_typing ()) {
+		*enter_room = 1;
+	    }
+	    break;
+	case CMD_QUIT: return 1;
+	default: break;
+    }
+    return 0;
 }
 
 
@@ -762,6 +961,7 @@ status_thread (void* ignore)
      */
     status_msg[0] = '\0';
     (void)pthread_mutex_unlock (&msg_lock);
+    signal_status ();
     }
 
     /* This code never executes--the thread should always be cancelled. */
@@ -780,16 +980,155 @@ status_thread (void* ignore)
  *   SIDE EFFECTS: none
  */
 static int
-time_is_after (struct timeval* t1, struct timeval* t2)
+time_is_after (struct timespec* t1, struct timespec* t2)
 {
     if (t1->tv_sec == t2->tv_sec)
-        return (t1->tv_usec >= t2->tv_usec);
+        return (t1->tv_nsec >= t2->tv_nsec);
     if (t1->tv_sec > t2->tv_sec)
         return 1;
     return 0;
 }
 
 
+/* 
+ * advance_time
+ *   DESCRIPTION: Advance a time by a number of microseconds (less than
+ *                one second).
+ *   INPUTS: t -- the time to advance
+ *           usec -- microseconds to add
+ *   OUTPUTS: t -- the time usec later
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+advance_time (struct timespec* t, int32_t usec)
+{
+    if ((t->tv_nsec += usec * 1000) >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+
+/* 
+ * msec_until
+ *   DESCRIPTION: Find the number of milliseconds from one time until a
+ *                later one, rounded up, for use as an epoll_wait timeout.
+ *   INPUTS: now -- the current time
+ *           t -- the later time
+ *   OUTPUTS: none
+ *   RETURN VALUE: milliseconds from now until t, or 0 if t has passed
+ *   SIDE EFFECTS: none
+ */
+static int
+msec_until (const struct timespec* now, const struct timespec* t)
+{
+    int64_t nsec; /* nanoseconds until t */
+
+    nsec = (int64_t)(t->tv_sec - now->tv_sec) * 1000000000 + 
+	   (t->tv_nsec - now->tv_nsec);
+    return (0 >= nsec ? 0 : (int)((nsec + 999999) / 1000000));
+}
+
+
+/* 
+ * start_ticks
+ *   DESCRIPTION: Start (or restart) the periodic tick timer (see tick_fd),
+ *                with its first tick at a given time on the monotonic
+ *                clock.  If the timer can't be started, it is closed, 
+ *                and game_loop instead waits for each tick with a 
+ *                timeout.
+ *   INPUTS: first -- time of the first tick
+ *           usec -- time between ticks in microseconds (less than 1 s)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may close tick_fd
+ */
+static void
+start_ticks (const struct timespec* first, int32_t usec)
+{
+    struct itimerspec period; /* first tick and tick length */
+
+    if (-1 == tick_fd) {
+        return;
+    }
+    period.it_value = *first;
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_nsec = usec * 1000;
+    if (0 != timerfd_settime (tick_fd, TFD_TIMER_ABSTIME, &period, NULL)) {
+        (void)close (tick_fd);
+	tick_fd = -1;
+    }
+}
+
+
+/* 
+ * watch_fd
+ *   DESCRIPTION: Add a file descriptor to the event loop's epoll set, to
+ *                be reported when it has data to read.
+ *   INPUTS: epoll_fd -- the epoll set
+ *           wfd -- the file descriptor (or -1 for none)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the descriptor is watched, 0 if not (e.g., for a
+ *                 regular file, which epoll can't watch)
+ *   SIDE EFFECTS: none
+ */
+static int
+watch_fd (int epoll_fd, int wfd)
+{
+    struct epoll_event ev; /* events to report */
+
+    if (-1 == wfd) {
+        return 0;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = wfd;
+    return (0 == epoll_ctl (epoll_fd, EPOLL_CTL_ADD, wfd, &ev));
+}
+
+
+/* 
+ * loop_panic
+ *   DESCRIPTION: Give up on the game after a failure in the event loop.
+ *   INPUTS: what -- the call that failed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none (does not return)
+ *   SIDE EFFECTS: restores the display and terminal and exits
+ */
+static void
+loop_panic (const char* what)
+{
+    int err = errno; /* error from the failed call */
+
+    /* Panic!  (should never happen) */
+    clear_mode_X ();
+    shutdown_input ();
+    errno = err;
+    perror (what);
+    exit (3);
+}
+
+
+/* 
+ * signal_status
+ *   DESCRIPTION: Tell the event loop that the status message has changed,
+ *                so that the status bar is shown again at once.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to status_fd
+ */
+static void
+signal_status ()
+{
+    uint64_t one = 1; /* count to add to the eventfd */
+
+    if (-1 != status_fd) {
+        (void)write (status_fd, &one, sizeof (one));
+    }
+}
+
+
 /* 
  * show_status (interface function; declared in world.h)
  *   DESCRIPTION: Show a specific status message of up to STATUS_MSG_LEN
@@ -817,6 +1156,9 @@ show_status (const char* s)
 
     /* msg_lock critical section ends here. */
     (void)pthread_mutex_unlock (&msg_lock);
+
+    /* Show the new message at once. */
+    signal_status ();
 }
 
 
@@ -836,7 +1178,7 @@ main ()
 	int ldisc_num = N_MOUSE;
 	ioctl(fd, TIOCSETD, &ldisc_num);
 
-	ioctl(fd, TUX_INIT, 0);
+	tux_present = (-1 != fd && 0 == ioctl(fd, TUX_INIT, 0));
 
     /* Randomize for more fun (remove for deterministic layout). */
     srand (time (NULL));
@@ -852,7 +1194,8 @@ main ()
     PANIC ("failed sanity checks");
     }
 
-    /* Create status message thread. */
+    /* Create status message thread and its eventfd. */
+    status_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
     if (0 != pthread_create (&status_thread_id, NULL, status_thread, NULL)) {
         PANIC ("failed to create status thread");
     }
@@ -891,6 +1234,23 @@ main ()
     case GAME_QUIT: printf ("Quitter!\n"); break;
     }
 
+    /* Stop the tick timer and close the status message eventfd. */
+    if (-1 != tick_fd) {
+        (void)close (tick_fd);
+	tick_fd = -1;
+    }
+    if (-1 != status_fd) {
+        (void)close (status_fd);
+	status_fd = -1;
+    }
+
+    /* Release the world's assets, reporting on their memory if asked. */
+    release_world ();
+    if (NULL != getenv (ARENA_REPORT_ENV)) {
+        arena_report (stderr);
+    }
+    arena_release ();
+
     /* Return success. */
     return 0;
 }
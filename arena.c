@@ -0,0 +1,161 @@
+/*									tab:8
+ *
+ * arena.c - world asset arena
+ *
+ * The arena (see arena.h) is a bump allocator over one anonymous 
+ * mapping.  The address space is reserved without committing memory,
+ * so pages are only used as blocks are handed out.  The mapping is 
+ * aligned to a 2 MB boundary so that transparent hugepages can back it.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+
+/* size and alignment of a hugepage */
+#define ARENA_HUGEPAGE (2 * 1024 * 1024)
+
+
+/* local functions--see function headers for details */
+static void open_arena ();
+
+
+/* file-scope variables */
+
+static uint8_t*        arena_base = NULL;  /* start of arena, or NULL     */
+static void*           arena_map = NULL;   /* mapping holding the arena  */
+static size_t          arena_map_len;	   /* length of the mapping      */
+static size_t          arena_used;	   /* bytes handed out           */
+static uint32_t        arena_blocks;	   /* number of blocks handed out */
+static const char*     arena_backing;	   /* kind of pages backing arena */
+static pthread_once_t  arena_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* 
+ * arena_alloc
+ *   DESCRIPTION: Allocate a block from the arena.  Safe to call from 
+ *                several threads at once.
+ *   INPUTS: len -- size of the block in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the block (aligned to ARENA_ALIGN), or NULL if the 
+ *                 arena could not be set up or has no room left
+ *   SIDE EFFECTS: sets up the arena on the first call
+ */
+void*
+arena_alloc (size_t len)
+{
+    void* block = NULL; /* block handed out */
+
+    (void)pthread_once (&arena_once, open_arena);
+    len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    (void)pthread_mutex_lock (&arena_lock);
+    if (NULL != arena_base && ARENA_SIZE - arena_used >= len) {
+        block = arena_base + arena_used;
+	arena_used += len;
+	arena_blocks++;
+    }
+    (void)pthread_mutex_unlock (&arena_lock);
+    return block;
+}
+
+
+/* 
+ * arena_report
+ *   DESCRIPTION: Print the amount of the arena in use.
+ *   INPUTS: out -- stream for the report
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes one line to out
+ */
+void
+arena_report (FILE* out)
+{
+    (void)pthread_mutex_lock (&arena_lock);
+    if (NULL == arena_base) {
+        fprintf (out, "asset arena: not in use\n");
+    } else {
+        fprintf (out, "asset arena: %lu of %lu kB used in %u blocks (%s)\n",
+		 (unsigned long)(arena_used / 1024), 
+		 (unsigned long)(ARENA_SIZE / 1024), arena_blocks, 
+		 arena_backing);
+    }
+    (void)pthread_mutex_unlock (&arena_lock);
+}
+
+
+/* 
+ * arena_release
+ *   DESCRIPTION: Release all of the arena's memory at once.  Later 
+ *                allocations fail (and so fall back to malloc).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unmaps the arena; blocks from it may no longer be used
+ */
+void
+arena_release ()
+{
+    (void)pthread_once (&arena_once, open_arena);
+    (void)pthread_mutex_lock (&arena_lock);
+    if (NULL != arena_map) {
+        (void)munmap (arena_map, arena_map_len);
+	arena_map = NULL;
+	arena_base = NULL;
+    }
+    (void)pthread_mutex_unlock (&arena_lock);
+}
+
+
+/* 
+ * open_arena
+ *   DESCRIPTION: Reserve the arena's address space: hugetlb pages if 
+ *                asked for and available, or else ordinary pages on a
+ *                hugepage boundary, marked for transparent hugepages.
+ *                Hugetlb pages are reserved up front (MAP_NORESERVE 
+ *                would turn a shortage into SIGBUS on first touch).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: maps the arena, or leaves arena_base NULL on failure
+ */
+static void
+open_arena ()
+{
+    const char* env; /* hugetlb setting, if any   */
+    uint8_t*    map; /* start of mapping          */
+    size_t      pad; /* bytes skipped to align    */
+
+    env = getenv (ARENA_HUGETLB_ENV);
+    if (NULL != env && 0 == strcmp (env, "1")) {
+        map = mmap (NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, 
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (MAP_FAILED != map) {
+	    arena_map = arena_base = map;
+	    arena_map_len = ARENA_SIZE;
+	    arena_backing = "hugetlb pages";
+	    return;
+	}
+    }
+
+    map = mmap (NULL, ARENA_SIZE + ARENA_HUGEPAGE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (MAP_FAILED == map) {
+        return;
+    }
+    arena_map = map;
+    arena_map_len = ARENA_SIZE + ARENA_HUGEPAGE;
+    pad = (ARENA_HUGEPAGE - (uintptr_t)map % ARENA_HUGEPAGE) % ARENA_HUGEPAGE;
+    arena_base = map + pad;
+#if defined(MADV_HUGEPAGE)
+    arena_backing = (0 == madvise (arena_base, ARENA_SIZE, MADV_HUGEPAGE) ?
+		     "transparent hugepages" : "small pages");
+#else
+    arena_backing = "small pages";
+#endif
+}
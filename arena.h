@@ -0,0 +1,52 @@
+/*									tab:8
+ *
+ * arena.h - header file for the world asset arena
+ *
+ * The arena is one region of memory from which world assets that last
+ * for the whole game (object images) are allocated, so that their 
+ * pixel data lie close together rather than scattered over the heap.
+ * The region is reserved on first use, backed by transparent hugepages
+ * where the kernel allows (or by MAP_HUGETLB pages if ARENA_HUGETLB_ENV
+ * is set to "1"), and released all at once by arena_release.  Blocks
+ * cannot be freed individually.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/* alignment of every block (and so of padded image rows) */
+#define ARENA_ALIGN 64
+
+/* bytes of address space reserved for the arena */
+#if !defined(ARENA_SIZE)
+#define ARENA_SIZE (64 * 1024 * 1024)
+#endif
+
+/* environment variable asking for MAP_HUGETLB pages ("1") */
+#if !defined(ARENA_HUGETLB_ENV)
+#define ARENA_HUGETLB_ENV "ADVENTURE_ARENA_HUGETLB"
+#endif
+
+/* environment variable asking for a usage report at shutdown */
+#if !defined(ARENA_REPORT_ENV)
+#define ARENA_REPORT_ENV "ADVENTURE_ARENA_REPORT"
+#endif
+
+/* 
+ * Allocate len bytes, aligned to ARENA_ALIGN.  Returns NULL if the 
+ * arena cannot be set up or is full; callers then use malloc.
+ */
+extern void* arena_alloc (size_t len);
+
+/* Print the arena's usage. */
+extern void arena_report (FILE* out);
+
+/* Release the arena; all blocks allocated from it become invalid. */
+extern void arena_release ();
+
+#endif /* ARENA_H */
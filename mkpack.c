@@ -0,0 +1,173 @@
+/*									tab:8
+ *
+ * mkpack.c - utility program for building adventure game asset packs
+ *
+ * This file is a standalone utility program that copies a set of asset
+ * files (room photos, precompiled photos, and object images) into one
+ * asset pack (see pack.h).  Each asset is stored under the name given
+ * on the command line, which must be the name used by the game (for
+ * example, "images/backpack.photo").  The pack is written to a 
+ * temporary file and then renamed, so a running game that has mapped
+ * the old pack is not disturbed.  "make pack" builds the game's pack.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pack.h"
+#include "quantize.h"
+
+
+// Reads a whole file into a newly allocated buffer.  Returns the buffer
+// (and its length) on success, or NULL (after complaining) on failure.
+static uint8_t*
+read_asset (const char* fname, uint32_t* len)
+{
+    FILE*    in;
+    uint8_t* data;
+    long     size;
+
+    if (NULL == (in = fopen (fname, "rb")) || 
+        0 != fseek (in, 0, SEEK_END) || 0 > (size = ftell (in)) ||
+	0 != fseek (in, 0, SEEK_SET)) {
+        perror (fname);
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return NULL;
+    }
+    if (NULL == (data = malloc (size + 1)) ||
+        (size_t)size != fread (data, 1, size, in)) {
+        fprintf (stderr, "%s: read failed\n", fname);
+	free (data);
+	(void)fclose (in);
+	return NULL;
+    }
+    (void)fclose (in);
+    *len = size;
+    return data;
+}
+
+// Writes zero bytes to pad the output to the given offset.  Returns 1 on
+// success, or 0 on failure.
+static int
+pad_to (FILE* out, uint32_t* pos, uint32_t offset)
+{
+    static const uint8_t zeros[PACK_ALIGN];
+    uint32_t             n;
+
+    for (; offset > *pos; *pos += n) {
+        n = offset - *pos;
+	if (sizeof (zeros) < n) {
+	    n = sizeof (zeros);
+	}
+	if (1 != fwrite (zeros, n, 1, out)) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+int
+main (int argc, char* argv[])
+{
+    pack_header_t hdr;
+    pack_entry_t* entry;
+    uint32_t*     slot;
+    uint8_t*      data;
+    uint32_t      num;
+    uint32_t      idx;
+    uint32_t      s;
+    uint32_t      pos;
+    uint32_t      len;
+    char          tname[1024];
+    FILE*         out;
+    int32_t       written;
+
+    // Check syntax of invocation.
+    if (3 > argc) {
+    	fprintf (stderr, "usage: %s <pack file> <asset file> ...\n", 
+		 argv[0]);
+	return 2;
+    }
+
+    // Build the index: entries, then a hash table at most half full.
+    (void)memset (&hdr, 0, sizeof (hdr));
+    (void)memcpy (hdr.magic, PACK_MAGIC, sizeof (hdr.magic));
+    num = argc - 2;
+    hdr.num_entries = num;
+    for (hdr.num_slots = 1; 2 * num > hdr.num_slots; hdr.num_slots *= 2) { }
+    if (NULL == (entry = calloc (num, sizeof (entry[0]))) ||
+        NULL == (slot = calloc (hdr.num_slots, sizeof (slot[0])))) {
+        fprintf (stderr, "%s: out of memory\n", argv[0]);
+	return 3;
+    }
+    for (idx = 0; num > idx; idx++) {
+        if (PACK_NAME_LEN <= strlen (argv[idx + 2])) {
+	    fprintf (stderr, "%s: asset name too long\n", argv[idx + 2]);
+	    return 2;
+	}
+	(void)strcpy (entry[idx].name, argv[idx + 2]);
+	s = photo_hash (entry[idx].name, strlen (entry[idx].name)) & 
+	    (hdr.num_slots - 1);
+	for (; 0 != slot[s]; s = (s + 1) & (hdr.num_slots - 1)) {
+	    if (0 == strcmp (entry[slot[s] - 1].name, entry[idx].name)) {
+	        fprintf (stderr, "%s: asset named twice\n", entry[idx].name);
+		return 2;
+	    }
+	}
+	slot[s] = idx + 1;
+    }
+
+    // Try to open a temporary output file next to the pack.
+    if (sizeof (tname) <= (size_t)snprintf (tname, sizeof (tname), 
+					     "%s.%d.tmp", argv[1], getpid ()) ||
+        NULL == (out = fopen (tname, "wb"))) {
+        perror ("open output file");
+	return 2;
+    }
+
+    // Write the index, leaving the entry offsets and lengths for later.
+    pos = sizeof (hdr) + num * sizeof (entry[0]) + 
+	  hdr.num_slots * sizeof (slot[0]);
+    written = (1 == fwrite (&hdr, sizeof (hdr), 1, out) &&
+	       num == fwrite (entry, sizeof (entry[0]), num, out) &&
+	       hdr.num_slots == fwrite (slot, sizeof (slot[0]), 
+	       				hdr.num_slots, out));
+
+    // Copy each asset to the next aligned offset.
+    for (idx = 0; written && num > idx; idx++) {
+	if (NULL == (data = read_asset (entry[idx].name, &len))) {
+	    written = 0;
+	    break;
+	}
+	entry[idx].offset = (pos + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1);
+	entry[idx].length = len;
+	written = (pad_to (out, &pos, entry[idx].offset) &&
+		   (0 == len || 1 == fwrite (data, len, 1, out)));
+	pos += len;
+	free (data);
+    }
+
+    // Fill in the entries, then close the file and move it into place.
+    written = (written && 0 == fseek (out, sizeof (hdr), SEEK_SET) &&
+	       num == fwrite (entry, sizeof (entry[0]), num, out));
+    if (EOF == fclose (out)) {
+        written = 0;
+    }
+    if (!written || 0 != rename (tname, argv[1])) {
+	perror ("write pack file");
+        (void)unlink (tname);
+	return 3;
+    }
+    printf ("%s: %u assets, %u bytes\n", argv[1], num, pos);
+
+    // Free the index.
+    free (slot);
+    free (entry);
+    return 0;
+}
@@ -0,0 +1,323 @@
+/*									tab:8
+ *
+ * mkworld.c - utility program for generating synthetic stress worlds
+ *
+ * This file is a standalone utility program that generates a synthetic
+ * world for stressing the game's loader, caches, and compositor at many
+ * times the size of the real world.  Into the directory given, it
+ * writes room photos (r<n>.photo, 5:6:5 RGB as written by mp2photo),
+ * object images (o<n>.obj, 2:2:2 RGB as written by mp2object), and a
+ * header, world.h, holding the rooms and objects in the form of the
+ * room_data and obj_data tables in world.c.  Building the game with
+ * "make STRESS_WORLD=<directory>/world.h" adds them to the real world,
+ * and the player starts in the first synthetic room.
+ *
+ * The options set the number of rooms (-r), the size of their photos
+ * (-s <width>x<height>), the number of objects in each room (-o), the
+ * number of exits from each room (-d: 1 for "right" only, 2 to add
+ * "left", or 3 to add "enter" to a random room), the number of distinct
+ * photo files and object image files shared among them (-p and -i), and
+ * the seed for the random choices (-S).  The same options always give
+ * the same world.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "photo_headers.h"
+
+
+/* defaults for the options */
+#define DEF_ROOMS     610	/* ten times the real world    */
+#define DEF_WIDTH     1024	/* photo size                  */
+#define DEF_HEIGHT    768
+#define DEF_OBJECTS   4		/* objects per room            */
+#define DEF_DEGREE    3		/* exits from each room        */
+#define DEF_PHOTOS    32	/* distinct photo files        */
+#define DEF_IMAGES    16	/* distinct object image files */
+
+/*
+ * smallest photo accepted (the game's scrolling area), and largest
+ * (MAX_PHOTO_WIDTH/HEIGHT in photo.h)
+ */
+#define MIN_PHOTO_WIDTH  320
+#define MIN_PHOTO_HEIGHT 182
+#define MAX_MKWORLD_DIM  4096
+
+/* object images are from MIN_OBJ_DIM to MAX_OBJ_DIM pixels on a side */
+#define MIN_OBJ_DIM 8
+#define MAX_OBJ_DIM 64
+
+
+/* the shape of the world to generate */
+typedef struct {
+    int32_t  rooms;	/* number of rooms           */
+    uint32_t width;	/* photo width               */
+    uint32_t height;	/* photo height              */
+    int32_t  objects;	/* objects per room          */
+    int32_t  degree;	/* exits from each room      */
+    int32_t  photos;	/* distinct photo files      */
+    int32_t  images;	/* distinct object images    */
+    uint32_t seed;	/* seed for random choices   */
+} world_spec_t;
+
+
+// Returns the next number from a simple generator, so that the world
+// does not depend on the C library's rand.
+static uint32_t
+next_random (uint32_t* state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+// Writes one room photo: smooth color bands that differ from photo to
+// photo, with some noise, so that the quantizers have real work to do.
+// Returns 1 on success, or 0 on failure.
+static int
+write_photo (const char* fname, const world_spec_t* spec, int32_t which)
+{
+    photo_header_t hdr;
+    uint16_t*      row;
+    uint32_t       state;
+    uint32_t       x, y;
+    uint32_t       r, g, b;
+    FILE*          out;
+    int            ok;
+
+    if (NULL == (row = malloc (spec->width * sizeof (row[0])))) {
+        fprintf (stderr, "%s: out of memory\n", fname);
+	return 0;
+    }
+    if (NULL == (out = fopen (fname, "wb"))) {
+        perror (fname);
+	free (row);
+	return 0;
+    }
+    hdr.width = spec->width;
+    hdr.height = spec->height;
+    ok = (1 == fwrite (&hdr, sizeof (hdr), 1, out));
+    state = spec->seed ^ (which * 2654435761U);
+    for (y = 0; ok && spec->height > y; y++) {
+        for (x = 0; spec->width > x; x++) {
+	    r = ((x + which * 37) * 32 / spec->width + y / 64) & 0x1F;
+	    g = ((y + which * 11) * 64 / spec->height + x / 48) & 0x3F;
+	    b = ((x + y) / 16 + which * 5 + (next_random (&state) & 3)) & 0x1F;
+	    row[x] = (r << 11) | (g << 5) | b;
+	}
+	ok = (spec->width == fwrite (row, sizeof (row[0]), spec->width, out));
+    }
+    if (!ok) {
+        perror (fname);
+    }
+    if (EOF == fclose (out)) {
+        perror (fname);
+	ok = 0;
+    }
+    free (row);
+    return ok;
+}
+
+// Writes one object image: an ellipse of one color on a transparent
+// background.  Returns 1 on success, or 0 on failure.
+static int
+write_object (const char* fname, uint32_t w, uint32_t h, uint8_t color)
+{
+    photo_header_t hdr;
+    uint8_t        row[MAX_OBJ_DIM];
+    int32_t        x, y;
+    int32_t        dx, dy;
+    FILE*          out;
+    int            ok;
+
+    if (NULL == (out = fopen (fname, "wb"))) {
+        perror (fname);
+	return 0;
+    }
+    hdr.width = w;
+    hdr.height = h;
+    ok = (1 == fwrite (&hdr, sizeof (hdr), 1, out));
+    for (y = 0; ok && h > y; y++) {
+        for (x = 0; w > x; x++) {
+	    dx = 2 * x + 1 - (int32_t)w;
+	    dy = 2 * y + 1 - (int32_t)h;
+	    row[x] = ((int64_t)dx * dx * h * h + (int64_t)dy * dy * w * w <=
+		      (int64_t)w * w * h * h ? color : OBJ_CLR_TRANSP);
+	}
+	ok = (1 == fwrite (row, w, 1, out));
+    }
+    if (!ok) {
+        perror (fname);
+    }
+    if (EOF == fclose (out)) {
+        perror (fname);
+	ok = 0;
+    }
+    return ok;
+}
+
+// Writes the header holding the synthetic world's tables.  It is read
+// by world.c several times: once for the counts, then once for each
+// table (see STRESS_WORLD in world.c).  Returns 1 on success, or 0 on
+// failure.
+static int
+write_tables (const char* fname, const char* dir, const world_spec_t* spec,
+	      const uint32_t* obj_w, const uint32_t* obj_h)
+{
+    FILE*    out;
+    uint32_t state;
+    int32_t  idx;
+    int32_t  img;
+    int      ok;
+
+    if (NULL == (out = fopen (fname, "w"))) {
+        perror (fname);
+	return 0;
+    }
+    fprintf (out, "/*\n * %s - synthetic world generated by mkworld\n"
+	     " *\n * mkworld -r %d -s %ux%u -o %d -d %d -p %d -i %d -S %u %s\n"
+	     " */\n\n", fname, spec->rooms, spec->width, spec->height,
+	     spec->objects, spec->degree, spec->photos, spec->images,
+	     spec->seed, dir);
+
+    // The counts come first; the tables must be asked for.
+    fprintf (out, "#if defined(STRESS_ROOM_DATA)\n\n");
+    state = spec->seed;
+    for (idx = 0; spec->rooms > idx; idx++) {
+	fprintf (out, "    , {R_STRESS + %d, \"Stress %d\", "
+		 "\"%s/r%04d.photo\",\n", idx, idx, dir, idx % spec->photos);
+	if (2 <= spec->degree) {
+	    fprintf (out, "       R_STRESS + %d, ",
+		     (idx + spec->rooms - 1) % spec->rooms);
+	} else {
+	    fprintf (out, "       R_NONE, ");
+	}
+	if (3 <= spec->degree) {
+	    fprintf (out, "R_STRESS + %d, ",
+		     (int32_t)(next_random (&state) % spec->rooms));
+	} else {
+	    fprintf (out, "R_NONE, ");
+	}
+	fprintf (out, "R_STRESS + %d}\n", (idx + 1) % spec->rooms);
+    }
+
+    fprintf (out, "\n#elif defined(STRESS_OBJ_DATA)\n\n");
+    state = spec->seed ^ 0x5A5A5A5A;
+    for (idx = 0; spec->rooms * spec->objects > idx; idx++) {
+	img = next_random (&state) % spec->images;
+	fprintf (out, "    , {O_STRESS + %d, \"thing%d\", \"%s/o%03d.obj\", "
+		 "R_STRESS + %d, %u, %u}\n", idx, idx, dir, img,
+		 idx / spec->objects,
+		 next_random (&state) % (spec->width - obj_w[img] + 1),
+		 next_random (&state) % (spec->height - obj_h[img] + 1));
+    }
+
+    fprintf (out, "\n#else /* the counts */\n\n"
+	     "#define STRESS_ROOMS   %d\n#define STRESS_OBJECTS %d\n\n"
+	     "#endif\n", spec->rooms, spec->rooms * spec->objects);
+    ok = !ferror (out);
+    if (EOF == fclose (out) || !ok) {
+        perror (fname);
+	return 0;
+    }
+    return 1;
+}
+
+int
+main (int argc, char* argv[])
+{
+    world_spec_t spec;
+    uint32_t     obj_w[1024];
+    uint32_t     obj_h[1024];
+    uint32_t     state;
+    char         fname[1200];
+    const char*  dir;
+    int32_t      i;
+    char         end;
+
+    // Check syntax of invocation.
+    spec.rooms = DEF_ROOMS;
+    spec.width = DEF_WIDTH;
+    spec.height = DEF_HEIGHT;
+    spec.objects = DEF_OBJECTS;
+    spec.degree = DEF_DEGREE;
+    spec.photos = DEF_PHOTOS;
+    spec.images = DEF_IMAGES;
+    spec.seed = 1;
+    for (i = 1; argc > i + 1 && '-' == argv[i][0]; i += 2) {
+        if (0 == strcmp (argv[i], "-r")) {
+	    spec.rooms = atoi (argv[i + 1]);
+	} else if (0 == strcmp (argv[i], "-s")) {
+	    if (2 != sscanf (argv[i + 1], "%ux%u%c", &spec.width,
+	    		     &spec.height, &end)) {
+	        spec.width = 0;
+	    }
+	} else if (0 == strcmp (argv[i], "-o")) {
+	    spec.objects = atoi (argv[i + 1]);
+	} else if (0 == strcmp (argv[i], "-d")) {
+	    spec.degree = atoi (argv[i + 1]);
+	} else if (0 == strcmp (argv[i], "-p")) {
+	    spec.photos = atoi (argv[i + 1]);
+	} else if (0 == strcmp (argv[i], "-i")) {
+	    spec.images = atoi (argv[i + 1]);
+	} else if (0 == strcmp (argv[i], "-S")) {
+	    spec.seed = strtoul (argv[i + 1], NULL, 10);
+	} else {
+	    break;
+	}
+    }
+    if (i + 1 != argc || '-' == argv[i][0]) {
+    	fprintf (stderr, "usage: %s [-r <rooms>] [-s <width>x<height>] "
+		 "[-o <objects per room>]\n"
+		 "\t[-d <exits per room>] [-p <photos>] [-i <object images>] "
+		 "[-S <seed>] <directory>\n", argv[0]);
+	return 2;
+    }
+    dir = argv[i];
+    if (1 > spec.rooms || 0 > spec.objects || 1 > spec.degree ||
+        3 < spec.degree || 1 > spec.images || 1024 < spec.images ||
+	MIN_PHOTO_WIDTH > spec.width || MAX_MKWORLD_DIM < spec.width ||
+	MIN_PHOTO_HEIGHT > spec.height || MAX_MKWORLD_DIM < spec.height) {
+	fprintf (stderr, "%s: need at least one room, one to three exits, "
+		 "1 to 1024 object images,\n\tand photos from %dx%d to "
+		 "%dx%d\n", argv[0], MIN_PHOTO_WIDTH, MIN_PHOTO_HEIGHT,
+		 MAX_MKWORLD_DIM, MAX_MKWORLD_DIM);
+	return 2;
+    }
+    if (1 > spec.photos || spec.rooms < spec.photos) {
+        spec.photos = spec.rooms;
+    }
+    if (strlen (dir) > sizeof (fname) - 32) {
+        fprintf (stderr, "%s: directory name too long\n", argv[0]);
+	return 2;
+    }
+    (void)mkdir (dir, 0777);
+
+    // Write the photos and object images.
+    for (i = 0; spec.photos > i; i++) {
+        (void)sprintf (fname, "%s/r%04d.photo", dir, i);
+	if (!write_photo (fname, &spec, i)) {
+	    return 3;
+	}
+    }
+    state = spec.seed;
+    for (i = 0; spec.images > i; i++) {
+	obj_w[i] = MIN_OBJ_DIM + next_random (&state) %
+				 (MAX_OBJ_DIM - MIN_OBJ_DIM + 1);
+	obj_h[i] = MIN_OBJ_DIM + next_random (&state) %
+				 (MAX_OBJ_DIM - MIN_OBJ_DIM + 1);
+        (void)sprintf (fname, "%s/o%03d.obj", dir, i);
+	if (!write_object (fname, obj_w[i], obj_h[i],
+			   next_random (&state) % OBJ_CLR_TRANSP)) {
+	    return 3;
+	}
+    }
+
+    // Write the tables.
+    (void)sprintf (fname, "%s/world.h", dir);
+    return (write_tables (fname, dir, &spec, obj_w, obj_h) ? 0 : 3);
+}
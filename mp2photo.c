@@ -45,30 +45,97 @@
  * The output file format is 5:6:5 RGB stored in the same order as in the
  * BMP, i.e., rows from bottom to top, and from right to left within each
  * row.  The header simply gives the dimensions of the image.
+ *
+ * The BMP is converted in chunks of at most ROW_CHUNK pixels, so the
+ * memory used does not depend on the size of the image, and images as
+ * large as a panorama (see photoc -t and pano.h) can be converted.  With
+ * -t <width>x<height>, the image is instead split into tiles of at most
+ * that size, each written to its own output file: tile (r,c), counting
+ * rows of tiles from the top, of "name.photo" goes to "name_r_c.photo".
+ * Images too large for one output file must be split.
+ *
+ * With -b, any number of BMP files (or directories, in which all files
+ * ending in ".bmp" are taken) are converted in batch mode, on several 
+ * threads at once.  The output for "name.bmp" goes to "name.photo" (or
+ * "name.obj" for mp2object), in the same directory or in the one given
+ * with -o.  The hash of each BMP converted is recorded in a file named
+ * MP2PHOTO_SUMS in the output directory (or in the current directory),
+ * and a BMP whose hash has not changed since its output was written is 
+ * skipped.
  */
 
 
+#include <dirent.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "photo_headers.h"
+#include "quantize.h"
 
 
 #if !defined(WRITE_OBJECT_IMAGE)
 #define WRITE_OBJECT_IMAGE 0		/* output defaults to room photo */
 #endif
 
+#if (1 == WRITE_OBJECT_IMAGE)
+#define OUTPUT_SUFFIX ".obj"		/* replaces ".bmp" in batch mode */
+typedef uint8_t out_pixel_t;		/* 2:2:2 RGB                     */
+#else /* (1 != WRITE_OBJECT_IMAGE) */
+#define OUTPUT_SUFFIX ".photo"
+typedef uint16_t out_pixel_t;		/* 5:6:5 RGB                     */
+#endif /* WRITE_OBJECT_IMAGE */
+
+/* hashes of the BMP files converted in batch mode */
+#if !defined(MP2PHOTO_SUMS)
+#define MP2PHOTO_SUMS ".mp2photo_sums"
+#endif
+
+/* most threads used in batch mode */
+#define MAX_BATCH_THREADS 64
+
+/* most pixels converted at once */
+#if !defined(ROW_CHUNK)
+#define ROW_CHUNK 4096
+#endif
+
+/* largest output file, or tile, in either dimension (see photo_header_t) */
+#define MAX_OUTPUT_DIM 65535
+
+
+/* one file to convert in batch mode */
+typedef struct {
+    char*    src;	/* BMP file name                          */
+    char*    dst;	/* output file name                       */
+    uint64_t old_sum;	/* hash recorded for the output, if any   */
+    uint64_t sum;	/* hash of the BMP (0 if it can't be read) */
+    int32_t  status;	/* 0 converted, 1 up to date, -1 failed   */
+} batch_job_t;
+
+/* the files to convert, handed out to the threads in order */
+typedef struct {
+    batch_job_t*    job;	/* the files          */
+    int32_t         num_jobs;	/* number of files    */
+    int32_t         next;	/* next file to start */
+    pthread_mutex_t lock;	/* protects next      */
+    uint32_t        tile_w;	/* tile width (or 0)  */
+    uint32_t        tile_h;	/* tile height        */
+} batch_t;
+
 
 /* 
  * Calculate width of one row of a BMP image in bytes, including padding
  * (to multiple of 4 bytes).
  */
-static int32_t
+static uint64_t
 bmp_row_width (const bmp_header_t* h)
 {
-    return 4 * ((3 * h->img_width + 3) / 4);
+    return 4 * ((3 * (uint64_t)h->img_width + 3) / 4);
 }
 
 // Reads BMP header from file and checks its validity.
@@ -77,7 +144,6 @@ static int
 bmp_header_check (const char* fname, FILE* in, bmp_header_t* h)
 {
     char     magic[3];
-    uint32_t row_width;
 
     // Check validity of input file.
     magic[2] = '\0';
@@ -87,14 +153,13 @@ bmp_header_check (const char* fname, FILE* in, bmp_header_t* h)
         fprintf (stderr, "%s does not appear to be a BMP file.\n", fname);
 	return 0;
     }
-    if (4096 < h->img_width || 4096 < h->img_height || 1 != h->planes || 
-    	24 != h->bits_per_pixel || 0 != h->compression_type) {
+    if (1 != h->planes || 24 != h->bits_per_pixel || 
+        0 != h->compression_type) {
         fprintf (stderr, "%s must be 24-bit-color on one plane with no "
 		 "compression.\n", fname);
         return 0;
     }
-    row_width = bmp_row_width (h);
-    if (h->img_size != row_width * h->img_height) {
+    if (h->img_size != bmp_row_width (h) * h->img_height) {
         fprintf (stderr, "%s image size incorrect in BMP/DIB header.\n",
 		 fname);
         return 0;
@@ -102,131 +167,576 @@ bmp_header_check (const char* fname, FILE* in, bmp_header_t* h)
     return 1;
 }
 
-// Read image data from BMP file into dynamically allocated memory.
-// Return pointer to memory on success, or NULL on failure.
-static uint8_t*
-read_bmp_image_data (FILE* in, const bmp_header_t* h)
+// Hashes the header and image data of a BMP file, reading the data in
+// chunks.  Return 1 on success, or 0 on failure.
+static int
+hash_bmp (FILE* in, const bmp_header_t* h, uint64_t* sum)
 {
-    uint8_t* img_data;
+    uint8_t  buf[3 * ROW_CHUNK];
+    uint64_t left;
+    size_t   len;
 
     // Seek to image data.
     if (0 != fseek (in, h->pixel_offset, SEEK_SET)) {
         perror ("fseek to start of image data in BMP file");
-        return NULL;
+        return 0;
     }
 
-    // Allocate space, then read in the image data.
-    if (NULL == (img_data = malloc (h->img_size)) ||
-    	1 != fread (img_data, h->img_size, 1, in)) {
-	if (NULL != img_data) {
-	    free (img_data);
+    // Read and hash it.
+    *sum = photo_hash (h, sizeof (*h));
+    for (left = h->img_size; 0 < left; left -= len) {
+        len = (sizeof (buf) < left ? sizeof (buf) : left);
+	if (1 != fread (buf, len, 1, in)) {
+	    perror ("read image");
+	    return 0;
 	}
-        perror ("allocate and read image");
-	return NULL;
+	*sum = (*sum * 0x9E3779B97F4A7C15ULL) ^ photo_hash (buf, len);
+    }
+    return 1;
+}
+
+// Converts one row of 24-bit BGR pixels into output pixels: 2:2:2 RGB 
+// bytes for an object image, or 5:6:5 RGB words (little endian) for a 
+// room photo.  The loop only reads and writes arrays, so the compiler
+// can vectorize it.
+static void
+convert_row (const uint8_t* bgr, out_pixel_t* out, uint32_t width)
+{
+    uint32_t x;
+
+    for (x = 0; width > x; x++) {
+#if (1 == WRITE_OBJECT_IMAGE)
+	uint8_t vga_color;
+ 	vga_color = ((bgr[3 * x + 2] >> 6) << 4) | 
+ 	            ((bgr[3 * x + 1] >> 6) << 2) | 
+ 		    (bgr[3 * x] >> 6);
+	/* 
+	 * We map any bright yellow pixel to transparent; it's easy to
+	 * be more specific by conditioning on the img data (24 bits)
+	 * rather than the output image data (6 bits).
+	 */
+	out[x] = (0x3C == vga_color ? OBJ_CLR_TRANSP : vga_color);
+#else /* (1 != WRITE_OBJECT_IMAGE) */
+	out[x] = ((bgr[3 * x + 2] >> 3) << 11) | 
+	         ((bgr[3 * x + 1] >> 2) << 5) | 
+		 (bgr[3 * x] >> 3);
+#endif /* WRITE_OBJECT_IMAGE */
     }
-    return img_data;
 }
 
-// Write header and data as either 5:6:5 RGB words (little endian) or
-// 2:2:2 RGB bytes, row by row, to the output file.  Return 1 on success, 
-// 0 on failure.
+// Names the output file for tile (r,c) of dst: "name.photo" becomes 
+// "name_r_c.photo".  Returns a dynamically allocated name, or NULL if
+// out of memory.
+static char*
+tile_name (const char* dst, uint32_t r, uint32_t c)
+{
+    const char* dot;
+    char*       name;
+    size_t      len;
+
+    dot = strrchr (dst, '.');
+    if (NULL == dot || NULL != strchr (dot, '/')) {
+        dot = dst + strlen (dst);
+    }
+    len = dot - dst;
+    if (NULL != (name = malloc (strlen (dst) + 24))) {
+	(void)sprintf (name, "%.*s_%u_%u%s", (int)len, dst, r, c, dot);
+    }
+    return name;
+}
+
+// Write one output file (or tile): header and data as either 5:6:5 RGB
+// words (little endian) or 2:2:2 RGB bytes, row by row, converted from
+// the w by ht pixels of the BMP whose lower left corner is column x, 
+// BMP row y (counting up from the bottom).  The rows are read one chunk
+// at a time, in the order in which they are written.  Return 1 on 
+// success, 0 on failure.
 static int
-write_output_file (FILE* out, const bmp_header_t* h, const uint8_t* img)
+write_output_file (const char* fname, FILE* in, const bmp_header_t* h, 
+		   uint32_t x, uint32_t y, uint32_t w, uint32_t ht)
 {
+    uint8_t        bgr[3 * ROW_CHUNK];
+    out_pixel_t    pixels[ROW_CHUNK];
     photo_header_t photo_header;
-    uint32_t       row_width;
-    uint16_t	   x;
-    uint16_t	   y;
+    FILE*          out;
+    uint64_t       row_width;
+    uint64_t       pos;
+    uint32_t       row;
+    uint32_t       done;
+    uint32_t       n;
+    int            ok = 1;
 
-    // Write header to output file.
-    photo_header.width = h->img_width;
-    photo_header.height = h->img_height;
-    if (1 != fwrite (&photo_header, sizeof (photo_header), 1, out)) {
-        perror ("write header to output file");
+    if (NULL == (out = fopen (fname, "wb"))) {
+        perror (fname);
 	return 0;
     }
 
-    // Write image data to output file.
+    // Write the header.
+    photo_header.width = w;
+    photo_header.height = ht;
+    if (1 != fwrite (&photo_header, sizeof (photo_header), 1, out)) {
+	ok = 0;
+    }
+
+    // Convert and write the rows.  Seek only when the next pixels to read
+    // are not the next in the BMP file (that is, between tiles).
     row_width = bmp_row_width (h);
-    for (y = 0; h->img_height > y; y++) {
-	for (x = 0; h->img_width > x; x++) {
-#if (1 == WRITE_OBJECT_IMAGE)
-	    uint8_t vga_color;
- 	    vga_color = ((img[row_width * y + 3 * x + 2] >> 6) << 4) | 
- 	    		((img[row_width * y + 3 * x + 1] >> 6) << 2) | 
- 			(img[row_width * y + 3 * x] >> 6);
-	    /* 
-	     * We map any bright yellow pixel to transparent; it's easy to
-	     * be more specific by conditioning on the img data (24 bits)
-	     * rather than the output image data (6 bits).
-	     */
-	    if (0x3C == vga_color) {
- 	        vga_color = OBJ_CLR_TRANSP;
- 	    }
-#else /* (1 != WRITE_OBJECT_IMAGE) */
-	    uint16_t vga_color;
-	    vga_color = ((img[row_width * y + 3 * x + 2] >> 3) << 11) | 
-	    		((img[row_width * y + 3 * x + 1] >> 2) << 5) | 
-			(img[row_width * y + 3 * x] >> 3);
-#endif /* WRITE_OBJECT_IMAGE */
-	    if (1 != fwrite (&vga_color, sizeof (vga_color), 1, out)) {
-	        perror ("write data to output file");
+    pos = (uint64_t)-1;
+    for (row = y; ok && y + ht > row; row++) {
+	if (pos != h->pixel_offset + row_width * row + 3 * (uint64_t)x) {
+	    pos = h->pixel_offset + row_width * row + 3 * (uint64_t)x;
+	    if (0 != fseeko (in, pos, SEEK_SET)) {
+	        ok = 0;
+		break;
+	    }
+	}
+        for (done = 0; ok && w > done; done += n) {
+	    n = (ROW_CHUNK < w - done ? ROW_CHUNK : w - done);
+	    if (1 != fread (bgr, 3 * n, 1, in)) {
+	        ok = 0;
+		break;
+	    }
+	    convert_row (bgr, pixels, n);
+	    if (n != fwrite (pixels, sizeof (pixels[0]), n, out)) {
+	        ok = 0;
+	    }
+	}
+	pos += 3 * (uint64_t)w;
+
+	// Skip the padding after a full row rather than seeking past it.
+	if (ok && w == h->img_width && row_width > 3 * (uint64_t)w) {
+	    if (1 != fread (bgr, row_width - 3 * (uint64_t)w, 1, in)) {
+		ok = 0;
+	    }
+	    pos += row_width - 3 * (uint64_t)w;
+	}
+    }
+    if (!ok) {
+	perror (fname);
+    }
+    if (EOF == fclose (out)) {
+	perror (fname);
+	ok = 0;
+    }
+    return ok;
+}
+
+// Converts the image data of a BMP file into one output file, or into
+// tiles of at most tile_w by tile_h pixels (see tile_name) if tile_w is
+// not 0.  Return 1 on success, 0 on failure.
+static int
+convert_bmp (const char* src, FILE* in, const bmp_header_t* h, 
+	     const char* dst, uint32_t tile_w, uint32_t tile_h)
+{
+    char*    name;
+    uint32_t r, c;
+    uint32_t ht;
+    int      ok = 1;
+
+    if (0 == tile_w) {
+	if (MAX_OUTPUT_DIM < h->img_width || MAX_OUTPUT_DIM < h->img_height) {
+	    fprintf (stderr, "%s is too large for one output file; split it "
+		     "with -t.\n", src);
+	    return 0;
+	}
+        return write_output_file (dst, in, h, 0, 0, h->img_width,
+				  h->img_height);
+    }
+
+    // The BMP is stored from the bottom up, so the bottom row of tiles 
+    // (which may be shorter than the rest) comes first in the file.
+    for (r = (h->img_height + tile_h - 1) / tile_h; ok && 0 < r--; ) {
+        ht = (h->img_height - r * tile_h < tile_h ? 
+	      h->img_height - r * tile_h : tile_h);
+	for (c = 0; ok && h->img_width > c * tile_w; c++) {
+	    if (NULL == (name = tile_name (dst, r, c))) {
+	        fprintf (stderr, "%s: out of memory\n", dst);
 		return 0;
 	    }
+	    ok = write_output_file (name, in, h, c * tile_w, 
+				    h->img_height - r * tile_h - ht,
+				    (h->img_width - c * tile_w < tile_w ? 
+				     h->img_width - c * tile_w : tile_w), ht);
+	    free (name);
 	}
     }
+    return ok;
+}
 
+// Converts one BMP file in batch mode, unless the output exists and the
+// BMP's hash matches the one recorded for the output.  Fills in the 
+// job's hash and status.
+static void
+convert_job (const batch_t* batch, batch_job_t* job)
+{
+    FILE*        in;
+    bmp_header_t bmp_header;
+    char*        first;
+    struct stat  st;
+    int          exists;
+
+    // Read and hash the BMP.
+    job->status = -1;
+    if (NULL == (in = fopen (job->src, "rb"))) {
+        perror (job->src);
+	return;
+    }
+    if (!bmp_header_check (job->src, in, &bmp_header) ||
+	!hash_bmp (in, &bmp_header, &job->sum)) {
+	(void)fclose (in);
+	return;
+    }
+    job->sum ^= (WRITE_OBJECT_IMAGE + 1) ^ 
+		((uint64_t)batch->tile_w << 32) ^ ((uint64_t)batch->tile_h << 48);
+    job->sum += (0 == job->sum);
+
+    // Skip it if nothing has changed (and the output, or its first tile,
+    // exists); otherwise write the output.
+    first = (0 == batch->tile_w ? job->dst : tile_name (job->dst, 0, 0));
+    exists = (NULL != first && 0 == stat (first, &st));
+    if (first != job->dst) {
+        free (first);
+    }
+    if (job->sum == job->old_sum && exists) {
+        job->status = 1;
+    } else if (convert_bmp (job->src, in, &bmp_header, job->dst, 
+			    batch->tile_w, batch->tile_h)) {
+	job->status = 0;
+    }
+    (void)fclose (in);
+}
+
+// Thread that takes files from the batch in order and converts them 
+// until none are left.
+static void*
+batch_worker (void* arg)
+{
+    batch_t*     batch = arg;
+    batch_job_t* job;
+
+    while (1) {
+	(void)pthread_mutex_lock (&batch->lock);
+	job = (batch->num_jobs > batch->next ? 
+	       &batch->job[batch->next++] : NULL);
+	(void)pthread_mutex_unlock (&batch->lock);
+	if (NULL == job) {
+	    return NULL;
+	}
+	convert_job (batch, job);
+    }
+}
+
+// Adds a BMP file to the batch, picking its output file name.  Returns
+// 1 on success, or 0 if out of memory.
+static int
+add_job (batch_t* batch, const char* src, const char* out_dir)
+{
+    batch_job_t* grown;
+    batch_job_t* job;
+    const char*  base;
+    size_t       len;
+
+    if (0 == (batch->num_jobs & (batch->num_jobs - 1))) {
+        if (NULL == (grown = realloc (batch->job, (2 * batch->num_jobs + 1) *
+					          sizeof (batch->job[0])))) {
+	    return 0;
+	}
+	batch->job = grown;
+    }
+    job = &batch->job[batch->num_jobs];
+    (void)memset (job, 0, sizeof (*job));
+
+    // The output goes next to the BMP, or into out_dir.
+    if (NULL == out_dir) {
+        base = src;
+    } else {
+        base = (NULL == (base = strrchr (src, '/')) ? src : base + 1);
+    }
+    len = strlen (base);
+    if (4 <= len && 0 == strcasecmp (base + len - 4, ".bmp")) {
+        len -= 4;
+    }
+    if (NULL == (job->src = strdup (src)) ||
+        NULL == (job->dst = malloc ((NULL == out_dir ? 0 : 
+				     strlen (out_dir) + 1) + 
+				    len + sizeof (OUTPUT_SUFFIX)))) {
+	free (job->src);
+        return 0;
+    }
+    (void)sprintf (job->dst, "%s%s%.*s%s", (NULL == out_dir ? "" : out_dir),
+		   (NULL == out_dir ? "" : "/"), (int)len, base, OUTPUT_SUFFIX);
+    batch->num_jobs++;
+    return 1;
+}
+
+// Compares two file names for qsort.
+static int
+name_cmp (const void* a, const void* b)
+{
+    return strcmp (*(char* const*)a, *(char* const*)b);
+}
+
+// Adds all of the BMP files in a directory to the batch, in order by 
+// name.  Returns 1 on success, or 0 on failure.
+static int
+add_dir_jobs (batch_t* batch, const char* dir, const char* out_dir)
+{
+    DIR*           d;
+    struct dirent* ent;
+    char**         name = NULL;
+    char**         grown;
+    int32_t        num = 0;
+    int32_t        idx;
+    size_t         len;
+    int            ok = 1;
+
+    if (NULL == (d = opendir (dir))) {
+        perror (dir);
+	return 0;
+    }
+    while (ok && NULL != (ent = readdir (d))) {
+	len = strlen (ent->d_name);
+        if (4 >= len || 0 != strcasecmp (ent->d_name + len - 4, ".bmp")) {
+	    continue;
+	}
+	if (0 == (num & (num - 1))) {
+	    if (NULL == (grown = realloc (name, (2 * num + 1) * 
+	    				  sizeof (name[0])))) {
+	        ok = 0;
+		continue;
+	    }
+	    name = grown;
+	}
+	if (NULL == (name[num] = malloc (strlen (dir) + len + 2))) {
+	    ok = 0;
+	    continue;
+	}
+	(void)sprintf (name[num++], "%s/%s", dir, ent->d_name);
+    }
+    (void)closedir (d);
+    qsort (name, num, sizeof (name[0]), name_cmp);
+    for (idx = 0; num > idx; idx++) {
+        ok = (ok && add_job (batch, name[idx], out_dir));
+	free (name[idx]);
+    }
+    free (name);
+    if (!ok) {
+        fprintf (stderr, "%s: out of memory\n", dir);
+    }
+    return ok;
+}
+
+// Converts a batch of BMP files, several at once, skipping those that 
+// have not changed (see MP2PHOTO_SUMS).  Returns the exit status.
+static int
+run_batch (batch_t* batch, const char* out_dir, int32_t num_threads)
+{
+    pthread_t   tid[MAX_BATCH_THREADS];
+    char        sums_name[1024];
+    char        line[1200];
+    char        name[1024];
+    FILE*       sums;
+    char**      kept = NULL;
+    char**      grown;
+    int32_t     num_kept = 0;
+    int32_t     num_started;
+    int32_t     count[3];
+    unsigned long long sum;
+    int32_t     idx;
+    int32_t     found;
+
+    // Read the hashes recorded last time.  Lines for outputs not in this
+    // batch are kept as they are.
+    (void)snprintf (sums_name, sizeof (sums_name), "%s%s%s", 
+		    (NULL == out_dir ? "" : out_dir), 
+		    (NULL == out_dir ? "" : "/"), MP2PHOTO_SUMS);
+    if (NULL != (sums = fopen (sums_name, "r"))) {
+	while (NULL != fgets (line, sizeof (line), sums)) {
+	    if (2 != sscanf (line, "%llx %1023[^\n]", &sum, name)) {
+	        continue;
+	    }
+	    for (idx = 0, found = 0; batch->num_jobs > idx; idx++) {
+	        if (0 == strcmp (name, batch->job[idx].dst)) {
+		    batch->job[idx].old_sum = sum;
+		    found = 1;
+		}
+	    }
+	    if (!found && 0 == (num_kept & (num_kept - 1)) &&
+		NULL != (grown = realloc (kept, (2 * num_kept + 1) * 
+					  sizeof (kept[0])))) {
+		kept = grown;
+	    }
+	    if (!found && NULL != kept &&
+		NULL != (kept[num_kept] = strdup (line))) {
+	        num_kept++;
+	    }
+	}
+	(void)fclose (sums);
+    }
+
+    // Convert the files.  This thread works too.
+    batch->next = 0;
+    (void)pthread_mutex_init (&batch->lock, NULL);
+    for (num_started = 0; 
+	 num_threads - 1 > num_started && batch->num_jobs - 1 > num_started &&
+	 0 == pthread_create (&tid[num_started], NULL, batch_worker, batch);
+	 num_started++) {
+    }
+    (void)batch_worker (batch);
+    for (idx = 0; num_started > idx; idx++) {
+        (void)pthread_join (tid[idx], NULL);
+    }
+    (void)pthread_mutex_destroy (&batch->lock);
+
+    // Record the hashes of the files converted or up to date.
+    if (NULL != (sums = fopen (sums_name, "w"))) {
+	for (idx = 0; num_kept > idx; idx++) {
+	    (void)fputs (kept[idx], sums);
+	}
+	for (idx = 0; batch->num_jobs > idx; idx++) {
+	    if (0 <= batch->job[idx].status) {
+	        fprintf (sums, "%016llx %s\n", 
+			 (unsigned long long)batch->job[idx].sum, 
+			 batch->job[idx].dst);
+	    }
+	}
+	if (EOF == fclose (sums)) {
+	    perror (sums_name);
+	}
+    } else {
+        perror (sums_name);
+    }
+    for (idx = 0; num_kept > idx; idx++) {
+        free (kept[idx]);
+    }
+    free (kept);
+
+    // Report what was done.
+    count[0] = count[1] = count[2] = 0;
+    for (idx = 0; batch->num_jobs > idx; idx++) {
+        count[batch->job[idx].status + 1]++;
+    }
+    printf ("%d converted, %d up to date, %d failed\n", count[1], count[2],
+	    count[0]);
+    return (0 == count[0] ? 0 : 3);
+}
+
+// Parses the tile size given with -t ("<width>x<height>").  Returns 1 
+// on success, or 0 if the size is not valid.
+static int
+parse_tile_size (const char* arg, uint32_t* tile_w, uint32_t* tile_h)
+{
+    char end;
+
+    if (2 != sscanf (arg, "%ux%u%c", tile_w, tile_h, &end) ||
+        0 == *tile_w || 0 == *tile_h || 
+	MAX_OUTPUT_DIM < *tile_w || MAX_OUTPUT_DIM < *tile_h) {
+	fprintf (stderr, "bad tile size %s (need <width>x<height>, each "
+		 "from 1 to %d)\n", arg, MAX_OUTPUT_DIM);
+	return 0;
+    }
     return 1;
 }
 
+// Main program for batch mode (-b): parses the rest of the command line
+// and converts the files named.
+static int
+batch_main (int argc, char* argv[])
+{
+    batch_t     batch;
+    const char* out_dir = NULL;
+    struct stat st;
+    int32_t     num_threads;
+    int32_t     idx;
+    int         ok = 1;
+
+    (void)memset (&batch, 0, sizeof (batch));
+    num_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    for (idx = 2; argc > idx + 1 && '-' == argv[idx][0]; idx += 2) {
+        if (0 == strcmp (argv[idx], "-j")) {
+	    num_threads = atoi (argv[idx + 1]);
+	} else if (0 == strcmp (argv[idx], "-o")) {
+	    out_dir = argv[idx + 1];
+	} else if (0 == strcmp (argv[idx], "-t")) {
+	    if (!parse_tile_size (argv[idx + 1], &batch.tile_w, 
+				  &batch.tile_h)) {
+	        return 2;
+	    }
+	} else {
+	    break;
+	}
+    }
+    if (argc <= idx || (argc > idx && '-' == argv[idx][0])) {
+    	fprintf (stderr, "usage: %s -b [-j <threads>] [-o <output directory>] "
+		 "[-t <width>x<height>] <BMP file or directory> ...\n", 
+		 argv[0]);
+	return 2;
+    }
+    if (1 > num_threads) {
+        num_threads = 1;
+    } else if (MAX_BATCH_THREADS < num_threads) {
+        num_threads = MAX_BATCH_THREADS;
+    }
+
+    // Make a list of the files to convert.
+    for (; ok && argc > idx; idx++) {
+	if (0 == stat (argv[idx], &st) && S_ISDIR (st.st_mode)) {
+	    ok = add_dir_jobs (&batch, argv[idx], out_dir);
+	} else if (!(ok = add_job (&batch, argv[idx], out_dir))) {
+	    fprintf (stderr, "%s: out of memory\n", argv[idx]);
+	}
+    }
+    if (!ok) {
+        return 2;
+    }
+    return run_batch (&batch, out_dir, num_threads);
+}
+
 int
 main (int argc, char* argv[])
 {
     FILE*        in;
-    FILE*        out;
     bmp_header_t bmp_header;
-    uint8_t*     img_data;
+    uint32_t     tile_w = 0;
+    uint32_t     tile_h = 0;
+    int32_t      first_file = 1;
     int32_t      written;
 
     // Check syntax of invocation.
-    if (3 != argc) {
-    	fprintf (stderr, "usage: %s <BMP file name> <output file>\n", argv[0]);
+    if (2 <= argc && 0 == strcmp (argv[1], "-b")) {
+        return batch_main (argc, argv);
+    }
+    if (5 == argc && 0 == strcmp (argv[1], "-t")) {
+        if (!parse_tile_size (argv[2], &tile_w, &tile_h)) {
+	    return 2;
+	}
+	first_file = 3;
+    }
+    if (first_file + 2 != argc) {
+    	fprintf (stderr, "usage: %s [-t <width>x<height>] <BMP file name> "
+		 "<output file>\n"
+		 "       %s -b [-j <threads>] [-o <output directory>] "
+		 "[-t <width>x<height>] <BMP file or directory> ...\n", 
+		 argv[0], argv[0]);
 	return 2;
     }
 
-    // Try to open the two files.
-    if (NULL == (in = fopen (argv[1], "r+b"))) {
+    // Try to open the input file and check its validity.
+    if (NULL == (in = fopen (argv[first_file], "rb"))) {
         perror ("open BMP file");
 	return 2;
     }
-    if (NULL == (out = fopen (argv[2], "w+b"))) {
-	fclose (in);
-        perror ("open output file");
-	return 2;
-    }
-
-    // Check validity of input file, then read image data from input file.
-    if (!bmp_header_check (argv[1], in, &bmp_header) ||
-	NULL == (img_data = read_bmp_image_data (in, &bmp_header))) {
+    if (!bmp_header_check (argv[first_file], in, &bmp_header)) {
 	fclose (in);
-	fclose (out);
 	return 2;
     }
 
-    // Done with the input file.  Ignore remaining errors.
+    // Convert the image data, then close the input file.  Ignore errors
+    // in closing it.
+    written = convert_bmp (argv[first_file], in, &bmp_header, 
+			   argv[first_file + 1], tile_w, tile_h);
     (void)fclose (in);
 
-    // Try to write, then close, the output file.
-    written = write_output_file (out, &bmp_header, img_data);
-    if (EOF == fclose (out)) {
-	perror ("close output file");
-        written = 0;
-    }
-
-    // Free the image data.
-    free (img_data);
-
     // Return value based on success of output file write and close.
     return (written ? 0 : 3);
 }
-
@@ -0,0 +1,161 @@
+/*									tab:8
+ *
+ * pack.c - adventure game asset pack lookup
+ *
+ * The pack (see pack.h) is mapped read-only the first time an asset is
+ * requested, and stays mapped for the life of the program, so the 
+ * assets can be used in place: the operating system reads in their
+ * pages when they are first touched.  A missing or damaged pack is
+ * treated as empty.
+ */
+
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pack.h"
+#include "quantize.h"
+
+
+/* local functions--see function headers for details */
+static void open_pack ();
+static int pack_is_sane (const uint8_t* base, size_t len);
+
+
+/* file-scope variables */
+
+static const uint8_t*       pack_base = NULL;  /* pack mapping, or NULL  */
+static const pack_header_t* pack_hdr;	       /* pack header            */
+static const pack_entry_t*  pack_entry;	       /* pack entries           */
+static const uint32_t*      pack_slot;	       /* pack hash table        */
+static pthread_once_t       pack_once = PTHREAD_ONCE_INIT;
+
+
+/* 
+ * find_asset
+ *   DESCRIPTION: Find an asset in the asset pack.
+ *   INPUTS: name -- file name of the asset
+ *   OUTPUTS: len -- length of the asset data in bytes
+ *   RETURN VALUE: pointer to the asset data, or NULL if there is no pack
+ *                 or the asset is not in it
+ *   SIDE EFFECTS: maps the pack on the first call
+ */
+const void*
+find_asset (const char* name, size_t* len)
+{
+    uint32_t mask;	/* mask for slot numbers     */
+    uint32_t slot;	/* hash table slot           */
+    uint32_t idx;	/* entry index (plus one)    */
+
+    (void)pthread_once (&pack_once, open_pack);
+    if (NULL == pack_base) {
+        return NULL;
+    }
+    mask = pack_hdr->num_slots - 1;
+    slot = photo_hash (name, strlen (name)) & mask;
+    for (; 0 != (idx = pack_slot[slot]); slot = (slot + 1) & mask) {
+        if (0 == strcmp (name, pack_entry[idx - 1].name)) {
+	    *len = pack_entry[idx - 1].length;
+	    return pack_base + pack_entry[idx - 1].offset;
+	}
+    }
+    return NULL;
+}
+
+
+/* 
+ * open_pack
+ *   DESCRIPTION: Map the asset pack, if there is one.  Called once, via
+ *                pthread_once.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: maps the pack and sets the file-scope pack variables;
+ *                 complains on stderr about a damaged pack
+ */
+static void
+open_pack ()
+{
+    const char* fname; /* pack file name          */
+    int         fd;    /* pack file descriptor    */
+    struct stat st;    /* pack file status        */
+    void*       base;  /* start of pack mapping   */
+
+    if (NULL == (fname = getenv (ASSET_PACK_ENV))) {
+        fname = ASSET_PACK_FILE;
+    }
+    if ('\0' == *fname || -1 == (fd = open (fname, O_RDONLY))) {
+        return;
+    }
+    if (0 != fstat (fd, &st) || !S_ISREG (st.st_mode) ||
+        sizeof (pack_header_t) > (size_t)st.st_size ||
+	MAP_FAILED == (base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED,
+				    fd, 0))) {
+	(void)close (fd);
+        return;
+    }
+    (void)close (fd);
+    if (!pack_is_sane (base, st.st_size)) {
+        fprintf (stderr, "Ignoring damaged asset pack %s.\n", fname);
+	(void)munmap (base, st.st_size);
+	return;
+    }
+    pack_hdr = base;
+    pack_entry = (const pack_entry_t*)(pack_hdr + 1);
+    pack_slot = (const uint32_t*)(pack_entry + pack_hdr->num_entries);
+    pack_base = base;
+}
+
+
+/* 
+ * pack_is_sane
+ *   DESCRIPTION: Check that a pack's header, index, and hash table are
+ *                consistent with each other and with the file size, so
+ *                that lookups cannot stray outside of the mapping.
+ *   INPUTS: base -- start of the pack mapping
+ *           len -- length of the pack file in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the pack can be used, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int
+pack_is_sane (const uint8_t* base, size_t len)
+{
+    const pack_header_t* hdr = (const pack_header_t*)base; /* header */
+    const pack_entry_t*  entry;	/* pack entries              */
+    const uint32_t*      slot;	/* pack hash table           */
+    uint32_t             idx;	/* index over entries/slots  */
+    uint32_t             empty;	/* number of empty slots     */
+
+    if (0 != memcmp (hdr->magic, PACK_MAGIC, sizeof (hdr->magic)) ||
+        0 == hdr->num_slots || 0 != (hdr->num_slots & (hdr->num_slots - 1)) ||
+	hdr->num_entries >= hdr->num_slots ||
+	sizeof (*hdr) + (uint64_t)hdr->num_entries * sizeof (*entry) +
+	(uint64_t)hdr->num_slots * sizeof (*slot) > len) {
+        return 0;
+    }
+    entry = (const pack_entry_t*)(hdr + 1);
+    slot = (const uint32_t*)(entry + hdr->num_entries);
+    for (idx = 0; hdr->num_entries > idx; idx++) {
+        if ('\0' != entry[idx].name[PACK_NAME_LEN - 1] ||
+	    (uint64_t)entry[idx].offset + entry[idx].length > len) {
+	    return 0;
+	}
+    }
+
+    /* Every probe sequence must end at an empty slot. */
+    for (idx = 0, empty = 0; hdr->num_slots > idx; idx++) {
+        if (0 == slot[idx]) {
+	    empty++;
+	} else if (hdr->num_entries < slot[idx]) {
+	    return 0;
+	}
+    }
+    return (0 != empty);
+}
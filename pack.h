@@ -0,0 +1,64 @@
+/*									tab:8
+ *
+ * pack.h - header file for the adventure game asset pack
+ *
+ * An asset pack holds copies of the game's data files (room photos,
+ * precompiled photos, and object images) in one file, so the game can
+ * map a single file at startup instead of opening each asset in turn.
+ * Packs are built with mkpack (see mkpack.c); the game looks for one 
+ * named ASSET_PACK_FILE, or the file named by the ASSET_PACK_ENV 
+ * environment variable.  Assets not found in the pack are read from
+ * their own files, as before.
+ *
+ * Layout: a pack_header_t, then num_entries pack_entry_t structures,
+ * then a hash table of num_slots 32-bit slots, then the asset data.
+ * Each slot holds one plus the index of an entry, or 0 if empty; an
+ * asset name is found by hashing it (photo_hash) into the table and
+ * probing linearly.  Each asset starts at a multiple of PACK_ALIGN
+ * bytes in the file, so the pages of different assets are not shared.
+ */
+#ifndef PACK_H
+#define PACK_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#define PACK_MAGIC    "APK1"	/* asset pack magic sequence         */
+#define PACK_ALIGN    4096	/* alignment of asset data in pack   */
+#define PACK_NAME_LEN 56	/* longest asset name, including NUL */
+
+#if !defined(ASSET_PACK_FILE)
+#define ASSET_PACK_FILE "assets.pack"
+#endif
+#if !defined(ASSET_PACK_ENV)
+#define ASSET_PACK_ENV "ADVENTURE_PACK"
+#endif
+
+/* asset pack file header */
+typedef struct pack_header_t pack_header_t;
+struct pack_header_t {
+    char     magic[4];		/* PACK_MAGIC (not NUL-terminated)  */
+    uint32_t num_entries;	/* number of assets in pack         */
+    uint32_t num_slots;		/* size of hash table (power of 2)  */
+    uint32_t reserved;		/* zero                             */
+};
+
+/* one asset in a pack */
+typedef struct pack_entry_t pack_entry_t;
+struct pack_entry_t {
+    char     name[PACK_NAME_LEN]; /* file name of asset (NUL-terminated) */
+    uint32_t offset;		  /* file offset of asset data           */
+    uint32_t length;		  /* length of asset data in bytes       */
+};
+
+/* 
+ * Find an asset in the pack (which is mapped the first time it is
+ * needed).  Returns a pointer to the read-only asset data and sets
+ * *len to its length, or returns NULL if there is no pack or the 
+ * asset is not in it.  The data remain valid until the program ends.
+ */
+extern const void* find_asset (const char* name, size_t* len);
+
+#endif /* PACK_H */
@@ -0,0 +1,446 @@
+/*									tab:8
+ *
+ * pano.c - tile-streamed panorama rooms
+ *
+ * Each open panorama keeps a cache of PANO_CACHE_TILES tiles.  A line
+ * is drawn by copying from the tiles it crosses, reading any tile not
+ * in the cache from the file first (and throwing out the tile least
+ * recently used).  After each line, the tiles one step further along
+ * in the direction of scrolling are queued for a reader thread, which
+ * reads them into the cache in the background, so that by the time 
+ * the view reaches them they are usually there already.
+ *
+ * The cache is protected by one lock.  Tiles are only read from the
+ * file with the lock released; a cache slot being filled is marked 
+ * SLOT_LOADING so that nobody else uses or throws out the slot until
+ * the tile is in it.
+ */
+
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pano.h"
+
+
+/* number of tiles in each panorama's cache (1 MB with 64x64 tiles) */
+#if !defined(PANO_CACHE_TILES)
+#define PANO_CACHE_TILES 256
+#endif
+
+/* longest queue of tiles waiting for the reader thread */
+#if !defined(PANO_QUEUE_LEN)
+#define PANO_QUEUE_LEN 64
+#endif
+
+#define TILE_SIZE  (1 << QPAN_TILE_SHIFT)     /* tile width in pixels  */
+#define TILE_MASK  (TILE_SIZE - 1)
+#define TILE_BYTES (TILE_SIZE * TILE_SIZE)    /* tile size in bytes    */
+
+/* states of a cache slot */
+typedef enum {
+    SLOT_EMPTY,		/* holds no tile                   */
+    SLOT_LOADING,	/* tile being read in; do not use  */
+    SLOT_READY		/* holds slot_tile                 */
+} slot_state_t;
+
+struct pano_t {
+    int             fd;		 /* panorama file                      */
+    uint32_t        across;	 /* number of tiles across             */
+    uint32_t        down;	 /* number of tiles down               */
+    uint32_t        data_offset; /* file offset of first tile          */
+    uint8_t*        tiles;	 /* cache: PANO_CACHE_TILES tiles      */
+    int32_t*        tile_slot;	 /* slot holding each tile, or -1      */
+    int32_t         slot_tile[PANO_CACHE_TILES];  /* tile in each slot */
+    uint8_t         slot_state[PANO_CACHE_TILES]; /* a slot_state_t    */
+    uint32_t        slot_used[PANO_CACHE_TILES];  /* time of last use  */
+    uint32_t        now;	 /* clock for slot_used                */
+    uint32_t        queue[PANO_QUEUE_LEN]; /* tiles to read ahead      */
+    uint32_t        q_head;	 /* first tile in queue                */
+    uint32_t        q_count;	 /* number of tiles in queue           */
+    int32_t         last_x;	 /* column of last vertical line       */
+    int32_t         last_y;	 /* row of last horizontal line        */
+    int32_t         has_reader;	 /* reader thread is running           */
+    int32_t         stop;	 /* reader thread should exit          */
+    pthread_mutex_t lock;	 /* protects all of the above          */
+    pthread_cond_t  loaded;	 /* a tile has been read in            */
+    pthread_cond_t  wake;	 /* read-ahead queued, or stop set     */
+    pthread_t       reader;	 /* reader thread                      */
+};
+
+
+/* local functions--see function headers for details */
+static int32_t claim_slot (pano_t* pano);
+static void load_slot (pano_t* pano, int32_t slot, uint32_t tile);
+static int32_t get_tile (pano_t* pano, uint32_t tile);
+static void read_ahead (pano_t* pano, uint32_t tile);
+static void* reader_thread (void* arg);
+
+
+/* 
+ * open_panorama
+ *   DESCRIPTION: Open a panorama file, check its header, and set up an
+ *                empty tile cache and the reader thread.  If the thread
+ *                cannot be started, tiles are simply read as needed.
+ *   INPUTS: fname -- panorama file name
+ *   OUTPUTS: hdr -- panorama size
+ *            palette -- panorama palette
+ *   RETURN VALUE: the panorama, or NULL on failure
+ *   SIDE EFFECTS: opens the file and allocates the tile cache
+ */
+pano_t*
+open_panorama (const char* fname, photo_header_t* hdr, 
+	       uint8_t palette[192][3])
+{
+    qpan_header_t qh;	/* panorama file header   */
+    struct stat   st;	/* panorama file status   */
+    pano_t*       pano;	/* the panorama           */
+    uint32_t      t;	/* index over tiles/slots */
+    int           fd;	/* panorama file          */
+
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+        return NULL;
+    }
+    if (0 != fstat (fd, &st) ||
+        sizeof (qh) != pread (fd, &qh, sizeof (qh), 0) ||
+	0 != memcmp (qh.magic, QPAN_MAGIC, sizeof (qh.magic)) ||
+	QPAN_TILE_SHIFT != qh.tile_shift || 
+	0 == qh.width || 0 == qh.height ||
+	(uint64_t)qh.data_offset + (uint64_t)TILE_BYTES *
+	((qh.width + TILE_MASK) >> QPAN_TILE_SHIFT) *
+	((qh.height + TILE_MASK) >> QPAN_TILE_SHIFT) > (uint64_t)st.st_size ||
+	NULL == (pano = calloc (1, sizeof (*pano)))) {
+	(void)close (fd);
+        return NULL;
+    }
+    pano->fd = fd;
+    pano->across = (qh.width + TILE_MASK) >> QPAN_TILE_SHIFT;
+    pano->down = (qh.height + TILE_MASK) >> QPAN_TILE_SHIFT;
+    pano->data_offset = qh.data_offset;
+    if (NULL == (pano->tiles = malloc (PANO_CACHE_TILES * TILE_BYTES)) ||
+        NULL == (pano->tile_slot = malloc (pano->across * pano->down *
+					   sizeof (pano->tile_slot[0])))) {
+	if (NULL != pano->tiles) {
+	    free (pano->tiles);
+	}
+	free (pano);
+	(void)close (fd);
+        return NULL;
+    }
+    for (t = 0; pano->across * pano->down > t; t++) {
+        pano->tile_slot[t] = -1;
+    }
+    for (t = 0; PANO_CACHE_TILES > t; t++) {
+        pano->slot_tile[t] = -1;
+	pano->slot_state[t] = SLOT_EMPTY;
+    }
+    pano->last_x = pano->last_y = INT32_MIN;
+    (void)pthread_mutex_init (&pano->lock, NULL);
+    (void)pthread_cond_init (&pano->loaded, NULL);
+    (void)pthread_cond_init (&pano->wake, NULL);
+    pano->has_reader = (0 == pthread_create (&pano->reader, NULL, 
+    					     reader_thread, pano));
+
+    hdr->width = qh.width;
+    hdr->height = qh.height;
+    (void)memcpy (palette, qh.palette, sizeof (qh.palette));
+    return pano;
+}
+
+
+/* 
+ * pano_hline
+ *   DESCRIPTION: Copy part of a row of a panorama, then queue the tiles
+ *                that the next row in the direction of scrolling would
+ *                move into (if any) for reading ahead.
+ *   INPUTS: pano -- the panorama
+ *           (x,y) -- leftmost pixel to copy (within the panorama)
+ *           n -- number of pixels to copy (x + n <= width)
+ *   OUTPUTS: out -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may read tiles into the cache; may queue tiles
+ */
+void
+pano_hline (pano_t* pano, int32_t x, int32_t y, int32_t n, uint8_t* out)
+{
+    int32_t first_tx = x >> QPAN_TILE_SHIFT;  /* first tile column   */
+    int32_t ty = y >> QPAN_TILE_SHIFT;	      /* tile row            */
+    int32_t slot;			      /* cache slot of tile  */
+    int32_t len;			      /* pixels in one tile  */
+    int32_t tx;				      /* index over columns  */
+
+    (void)pthread_mutex_lock (&pano->lock);
+    for (; 0 < n; x += len, out += len, n -= len) {
+        len = TILE_SIZE - (x & TILE_MASK);
+	if (len > n) {
+	    len = n;
+	}
+	slot = get_tile (pano, ty * pano->across + (x >> QPAN_TILE_SHIFT));
+	(void)memcpy (out, pano->tiles + slot * TILE_BYTES + 
+		      ((y & TILE_MASK) << QPAN_TILE_SHIFT) + (x & TILE_MASK),
+		      len);
+    }
+
+    /* Read ahead into the next row of tiles (up or down). */
+    if (INT32_MIN != pano->last_y && y != pano->last_y) {
+        ty += (y > pano->last_y ? 1 : -1);
+	if (0 <= ty && pano->down > (uint32_t)ty) {
+	    for (tx = first_tx; (x - 1) >> QPAN_TILE_SHIFT >= tx; tx++) {
+		read_ahead (pano, ty * pano->across + tx);
+	    }
+	}
+    }
+    pano->last_y = y;
+    (void)pthread_mutex_unlock (&pano->lock);
+}
+
+
+/* 
+ * pano_vline
+ *   DESCRIPTION: Copy part of a column of a panorama, then queue the 
+ *                tiles that the next column in the direction of 
+ *                scrolling would move into (if any) for reading ahead.
+ *   INPUTS: pano -- the panorama
+ *           (x,y) -- top pixel to copy (within the panorama)
+ *           n -- number of pixels to copy (y + n <= height)
+ *   OUTPUTS: out -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may read tiles into the cache; may queue tiles
+ */
+void
+pano_vline (pano_t* pano, int32_t x, int32_t y, int32_t n, uint8_t* out)
+{
+    int32_t        first_ty = y >> QPAN_TILE_SHIFT; /* first tile row  */
+    int32_t        tx = x >> QPAN_TILE_SHIFT;	    /* tile column     */
+    const uint8_t* in;				    /* next pixel      */
+    int32_t        slot;			    /* slot of tile    */
+    int32_t        len;				    /* pixels in tile  */
+    int32_t        idx;				    /* index in tile   */
+    int32_t        ty;				    /* index over rows */
+
+    (void)pthread_mutex_lock (&pano->lock);
+    for (; 0 < n; y += len, n -= len) {
+        len = TILE_SIZE - (y & TILE_MASK);
+	if (len > n) {
+	    len = n;
+	}
+	slot = get_tile (pano, (y >> QPAN_TILE_SHIFT) * pano->across + tx);
+	in = pano->tiles + slot * TILE_BYTES + 
+	     ((y & TILE_MASK) << QPAN_TILE_SHIFT) + (x & TILE_MASK);
+	for (idx = 0; len > idx; idx++, in += TILE_SIZE) {
+	    *out++ = *in;
+	}
+    }
+
+    /* Read ahead into the next column of tiles (left or right). */
+    if (INT32_MIN != pano->last_x && x != pano->last_x) {
+        tx += (x > pano->last_x ? 1 : -1);
+	if (0 <= tx && pano->across > (uint32_t)tx) {
+	    for (ty = first_ty; (y - 1) >> QPAN_TILE_SHIFT >= ty; ty++) {
+		read_ahead (pano, ty * pano->across + tx);
+	    }
+	}
+    }
+    pano->last_x = x;
+    (void)pthread_mutex_unlock (&pano->lock);
+}
+
+
+/* 
+ * pano_memory
+ *   DESCRIPTION: Find the amount of memory used by an open panorama.
+ *   INPUTS: pano -- the panorama
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes used
+ *   SIDE EFFECTS: none
+ */
+size_t
+pano_memory (const pano_t* pano)
+{
+    return sizeof (*pano) + PANO_CACHE_TILES * TILE_BYTES + 
+	   pano->across * pano->down * sizeof (pano->tile_slot[0]);
+}
+
+
+/* 
+ * close_panorama
+ *   DESCRIPTION: Stop a panorama's reader thread and release the 
+ *                panorama.
+ *   INPUTS: pano -- the panorama
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the tile cache and closes the file
+ */
+void
+close_panorama (pano_t* pano)
+{
+    if (pano->has_reader) {
+	(void)pthread_mutex_lock (&pano->lock);
+	pano->stop = 1;
+	(void)pthread_cond_signal (&pano->wake);
+	(void)pthread_mutex_unlock (&pano->lock);
+	(void)pthread_join (pano->reader, NULL);
+    }
+    (void)pthread_cond_destroy (&pano->wake);
+    (void)pthread_cond_destroy (&pano->loaded);
+    (void)pthread_mutex_destroy (&pano->lock);
+    free (pano->tile_slot);
+    free (pano->tiles);
+    (void)close (pano->fd);
+    free (pano);
+}
+
+
+/* 
+ * claim_slot
+ *   DESCRIPTION: Pick a cache slot to hold a new tile: an empty slot if
+ *                there is one, or else the slot least recently used 
+ *                (never one being filled).  Call with the lock held.
+ *   INPUTS: pano -- the panorama
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot
+ *   SIDE EFFECTS: throws out the tile in the slot, if any
+ */
+static int32_t
+claim_slot (pano_t* pano)
+{
+    int32_t best = -1;	/* slot chosen so far */
+    int32_t s;		/* index over slots   */
+
+    for (s = 0; PANO_CACHE_TILES > s; s++) {
+        if (SLOT_EMPTY == pano->slot_state[s]) {
+	    return s;
+	}
+	if (SLOT_READY == pano->slot_state[s] &&
+	    (-1 == best || pano->slot_used[best] - pano->slot_used[s] <
+	     		   UINT32_MAX / 2)) {
+	    best = s;
+	}
+    }
+
+    /* At most two slots are ever loading, so one must be ready. */
+    pano->tile_slot[pano->slot_tile[best]] = -1;
+    pano->slot_tile[best] = -1;
+    pano->slot_state[best] = SLOT_EMPTY;
+    return best;
+}
+
+
+/* 
+ * load_slot
+ *   DESCRIPTION: Read a tile from the file into a cache slot.  The lock
+ *                is released while reading.  A tile that cannot be read
+ *                is shown as black.  Call with the lock held.
+ *   INPUTS: pano -- the panorama
+ *           slot -- the slot (from claim_slot)
+ *           tile -- the tile
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills the slot; wakes threads waiting for tiles
+ */
+static void
+load_slot (pano_t* pano, int32_t slot, uint32_t tile)
+{
+    uint8_t* buf = pano->tiles + slot * TILE_BYTES; /* tile's cache data */
+
+    pano->slot_state[slot] = SLOT_LOADING;
+    pano->slot_tile[slot] = tile;
+    pano->slot_used[slot] = ++pano->now;
+    pano->tile_slot[tile] = slot;
+    (void)pthread_mutex_unlock (&pano->lock);
+    if (TILE_BYTES != pread (pano->fd, buf, TILE_BYTES, pano->data_offset +
+    			     (off_t)tile * TILE_BYTES)) {
+        (void)memset (buf, 0, TILE_BYTES);
+    }
+    (void)pthread_mutex_lock (&pano->lock);
+    pano->slot_state[slot] = SLOT_READY;
+    (void)pthread_cond_broadcast (&pano->loaded);
+}
+
+
+/* 
+ * get_tile
+ *   DESCRIPTION: Find a tile in the cache, reading it in (or waiting for
+ *                the reader thread to finish reading it) if need be.  
+ *                Call with the lock held.
+ *   INPUTS: pano -- the panorama
+ *           tile -- the tile
+ *   OUTPUTS: none
+ *   RETURN VALUE: the cache slot holding the tile
+ *   SIDE EFFECTS: may read the tile into the cache
+ */
+static int32_t
+get_tile (pano_t* pano, uint32_t tile)
+{
+    int32_t slot; /* cache slot holding tile */
+
+    while (1) {
+        if (-1 == (slot = pano->tile_slot[tile])) {
+	    load_slot (pano, claim_slot (pano), tile);
+	} else if (SLOT_LOADING == pano->slot_state[slot]) {
+	    (void)pthread_cond_wait (&pano->loaded, &pano->lock);
+	} else {
+	    pano->slot_used[slot] = ++pano->now;
+	    return slot;
+	}
+    }
+}
+
+
+/* 
+ * read_ahead
+ *   DESCRIPTION: Ask the reader thread to read a tile into the cache, 
+ *                unless it is already there (or the queue is full).  
+ *                Call with the lock held.
+ *   INPUTS: pano -- the panorama
+ *           tile -- the tile
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may add the tile to the queue and wake the reader
+ */
+static void
+read_ahead (pano_t* pano, uint32_t tile)
+{
+    if (pano->has_reader && -1 == pano->tile_slot[tile] &&
+        PANO_QUEUE_LEN > pano->q_count) {
+        pano->queue[(pano->q_head + pano->q_count++) % PANO_QUEUE_LEN] = tile;
+	(void)pthread_cond_signal (&pano->wake);
+    }
+}
+
+
+/* 
+ * reader_thread
+ *   DESCRIPTION: Read queued tiles into the cache until told to stop.
+ *   INPUTS: arg -- the panorama (a pano_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills cache slots
+ */
+static void*
+reader_thread (void* arg)
+{
+    pano_t*  pano = arg; /* the panorama     */
+    uint32_t tile;	 /* tile to read in  */
+
+    (void)pthread_mutex_lock (&pano->lock);
+    while (!pano->stop) {
+        if (0 == pano->q_count) {
+	    (void)pthread_cond_wait (&pano->wake, &pano->lock);
+	    continue;
+	}
+	tile = pano->queue[pano->q_head];
+	pano->q_head = (pano->q_head + 1) % PANO_QUEUE_LEN;
+	pano->q_count--;
+	if (-1 == pano->tile_slot[tile]) {
+	    load_slot (pano, claim_slot (pano), tile);
+	}
+    }
+    (void)pthread_mutex_unlock (&pano->lock);
+    return NULL;
+}
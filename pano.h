@@ -0,0 +1,45 @@
+/*									tab:8
+ *
+ * pano.h - header file for tile-streamed panorama rooms
+ *
+ * A panorama (see qpan_header_t in photo_headers.h) is a room photo
+ * that is never held in memory as a whole.  Its tiles are read from
+ * the file into a fixed-size tile cache as lines of the panorama are
+ * drawn, and a reader thread reads ahead the tiles about to come into
+ * view in the direction in which the player is scrolling.
+ */
+#ifndef PANO_H
+#define PANO_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "photo_headers.h"
+
+
+/* an open panorama */
+typedef struct pano_t pano_t;
+
+/* 
+ * Open a panorama file, filling in its size and palette.  Returns the
+ * panorama, or NULL on failure.
+ */
+extern pano_t* open_panorama (const char* fname, photo_header_t* hdr,
+			      uint8_t palette[192][3]);
+
+/* Copy n pixels of row y, starting at column x, into out. */
+extern void pano_hline (pano_t* pano, int32_t x, int32_t y, int32_t n,
+			uint8_t* out);
+
+/* Copy n pixels of column x, starting at row y, into out. */
+extern void pano_vline (pano_t* pano, int32_t x, int32_t y, int32_t n,
+			uint8_t* out);
+
+/* Find the number of bytes of memory used by an open panorama. */
+extern size_t pano_memory (const pano_t* pano);
+
+/* Close a panorama, stopping its reader and freeing its tile cache. */
+extern void close_panorama (pano_t* pano);
+
+#endif /* PANO_H */
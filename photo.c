@@ -36,16 +36,86 @@
  */
 
 
+#include <fcntl.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "arena.h"
 #include "assert.h"
 #include "modex.h"
+#include "pack.h"
+#include "pano.h"
 #include "photo.h"
 #include "photo_headers.h"
+#include "quantize.h"
 #include "world.h"
 
 
 
+/* 
+ * Quantized photos are cached under PHOTO_CACHE_DIR, or under the 
+ * directory named by the PHOTO_CACHE_ENV environment variable, if set.
+ * Setting the variable to an empty string turns the cache off.
+ */
+#if !defined(PHOTO_CACHE_DIR)
+#define PHOTO_CACHE_DIR ".photo_cache"
+#endif
+#if !defined(PHOTO_CACHE_ENV)
+#define PHOTO_CACHE_ENV "ADVENTURE_PHOTO_CACHE"
+#endif
+
+/* 
+ * Room photos can be kept in memory with each row compressed (see 
+ * compress_photo).  Compression is on if COMPRESS_PHOTOS is non-zero,
+ * unless the COMPRESS_PHOTOS_ENV environment variable says otherwise 
+ * ("0" for off, "1" for on).  Rows are decoded into a cache of 
+ * PHOTO_ROW_CACHE rows when drawn; it should hold at least SCROLL_Y_DIM
+ * rows, so that drawing a vertical line decodes each row only once.
+ */
+#if !defined(COMPRESS_PHOTOS)
+#define COMPRESS_PHOTOS 0
+#endif
+#if !defined(COMPRESS_PHOTOS_ENV)
+#define COMPRESS_PHOTOS_ENV "ADVENTURE_COMPRESS_PHOTOS"
+#endif
+#if !defined(PHOTO_ROW_CACHE)
+#define PHOTO_ROW_CACHE 256
+#endif
+
+/* 
+ * Room photos are read in the layout named by the PHOTO_LAYOUT_ENV
+ * environment variable (see set_photo_layout), or PHOTO_ROWS.  Tiles
+ * in the PHOTO_TILED layout are PHOTO_TILE (1 << PHOTO_TILE_SHIFT)
+ * pixels on a side.
+ */
+#if !defined(PHOTO_LAYOUT_ENV)
+#define PHOTO_LAYOUT_ENV "ADVENTURE_PHOTO_LAYOUT"
+#endif
+#if !defined(PHOTO_TILE_SHIFT)
+#define PHOTO_TILE_SHIFT 5
+#endif
+#define PHOTO_TILE (1 << PHOTO_TILE_SHIFT)
+#define PHOTO_TILE_MASK (PHOTO_TILE - 1)
+
+/* 
+ * Offset of the row hash within the header block of an object image
+ * saved by save_obj_image (just past the photo_header_t).
+ */
+#define OBJ_SAVE_SUM 8
+
+/* number of tiles across a PHOTO_TILED photo */
+#define TILES_ACROSS(p) (((p)->hdr.width + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT)
+
+/* offset of pixel (x,y) in the pixel data of a PHOTO_TILED photo */
+#define TILED_OFFSET(p,x,y)                                              \
+    (((((y) >> PHOTO_TILE_SHIFT) * TILES_ACROSS (p) +                    \
+       ((x) >> PHOTO_TILE_SHIFT)) << (2 * PHOTO_TILE_SHIFT)) +           \
+     (((y) & PHOTO_TILE_MASK) << PHOTO_TILE_SHIFT) + ((x) & PHOTO_TILE_MASK))
+
+
 /* types local to this file (declared in types.h) */
 
 /* 
@@ -55,11 +125,42 @@
  * Pixel data are stored as one-byte values starting from the upper
  * left and traversing the top row before returning to the left of
  * the second row, and so forth.  No padding should be used.
+ * Photos loaded from a precompiled file point img into a read-only
+ * mapping of the file (map != NULL) or into the asset pack; other 
+ * photos allocate img on the heap (img_on_heap != 0).  A 
+ * compressed photo instead has img == NULL and keeps its pixel data
+ * in rle, with row y at rle + row_start[y] (see compress_photo).
+ * The pixel data may also be stored in other layouts (see photo.h and
+ * set_photo_layout); use photo_hline and photo_vline to get at the
+ * pixels of any photo.  A panorama has no pixel data in memory at all;
+ * its pixels are read from its file a tile at a time (see pano.c).
+ * The quantizer that chose the palette is kept so that a saved photo 
+ * (see save_photo) is recorded as built with it.
  */
 struct photo_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t        palette[192][3];     /* optimized palette colors */
     uint8_t*       img;                 /* pixel data               */
+    void*          map;			/* precompiled file mapping */
+    size_t         map_len;		/* length of file mapping   */
+    uint8_t        img_on_heap;		/* img came from malloc     */
+    uint8_t*       rle;			/* compressed pixel data    */
+    uint32_t*      row_start;		/* start of each row in rle */
+    uint8_t        layout;		/* a photo_layout_t         */
+    uint8_t*       cols;		/* PHOTO_DUAL columns       */
+    pano_t*        pano;		/* panorama, if any         */
+    uint8_t        quantizer;		/* quantizer_t that built it */
+};
+
+/* 
+ * A run of opaque pixels in a row or column of an object image: the 
+ * offset of the first pixel in the row (or column) and the number of 
+ * pixels.
+ */
+typedef struct obj_span_t obj_span_t;
+struct obj_span_t {
+    uint8_t start;	/* first opaque pixel     */
+    uint8_t len;	/* number of opaque pixels */
 };
 
 /* 
@@ -69,36 +170,91 @@ struct photo_t {
  * transparent pixels (value OBJ_CLR_TRANSP).  As with the room photos, 
  * pixel data are stored as one-byte values starting from the upper 
  * left and traversing the top row before returning to the left of the 
- * second row, and so forth.  No padding is used.
+ * second row, and so forth.  Rows are padded out to stride bytes so
+ * that each starts on an ARENA_ALIGN boundary (see read_obj_image).
+ * The opaque pixels are also indexed (see index_obj_image) so that 
+ * drawing can skip the transparent ones: the opaque spans of row y are
+ * span[row_span[y]] up to (but not including) span[row_span[y + 1]], 
+ * and those of column x are span[col_span[x]] up to span[col_span[x + 1]].
+ * All opaque pixels lie within the box from (box_left,box_top) up to 
+ * (but not including) (box_right,box_bottom), which is empty if the 
+ * image has no opaque pixels.  So that columns can be drawn with block
+ * copies just as rows are, the pixels are also kept column by column in
+ * cols, with each column (padded out to col_stride bytes) starting on 
+ * an ARENA_ALIGN boundary.
  */
 struct image_t {
-    photo_header_t hdr;			/* defines height and width */
-    uint8_t*       img;                 /* pixel data               */
+    photo_header_t    hdr;		/* defines height and width */
+    uint32_t          stride;		/* bytes from row to row    */
+    uint8_t*          img;              /* pixel data               */
+    uint32_t          col_stride;	/* bytes from column to column */
+    const uint8_t*    cols;		/* pixel data by column     */
+    uint16_t          box_left;		/* opaque bounding box      */
+    uint16_t          box_top;
+    uint16_t          box_right;
+    uint16_t          box_bottom;
+    const uint16_t*   row_span;		/* first span of each row   */
+    const uint16_t*   col_span;		/* first span of each column */
+    const obj_span_t* span;		/* opaque spans             */
 };
 
-////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
-/*Interface Description:
-The Octree structure represents a tree data structure used for color quantization or similar purposes.
-It consists of two levels: Level2 and Level4, with Level2 containing 64 nodes and Level4 containing 4096 nodes.
-Each node in the Octree_Node structure stores color information (RGB), sums of color components (Sum_R, Sum_G, Sum_B), 
-a count of the number of colors represented by the node (count)*/
-
-// Define the structure for a node in the Octree
-typedef struct Octree_Node {
-    uint32_t RGB;
-    uint32_t Sum_R;
-    uint32_t Sum_G;
-    uint32_t Sum_B;
-    uint32_t count;
-    uint32_t sorted_index; // A field to track sorted indices (bug log never kept track)
-} Octree_Node;
-
-// Define the Octree structure
-typedef struct Octree {
-    Octree_Node Level2[64];    // Array of nodes at level 2 (8^2 = 64 nodes)
-    Octree_Node Level4[4096];  // Array of nodes at level 4 (8^4 = 4096 nodes)
-} Octree;
-////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
+/* 
+ * A read-only view of the contents of an asset file.  The data lie
+ * either in the asset pack (map == NULL), which stays mapped until the
+ * program ends, or in a mapping of the file itself (map != NULL).
+ */
+typedef struct asset_view_t asset_view_t;
+struct asset_view_t {
+    const uint8_t* data;	/* file contents                     */
+    size_t         len;		/* length of file contents in bytes  */
+    void*          map;		/* file mapping to release, or NULL  */
+    size_t         map_len;	/* length of file mapping in bytes   */
+};
+
+/* 
+ * A read-only view of the 5:6:5 RGB pixels in a room photo file, in
+ * file order (lower left first, rows from bottom to top).  The pixels
+ * either lie in an asset view of the file (view.data != NULL) or in a
+ * packed heap copy (heap != NULL).
+ */
+typedef struct photo_src_t photo_src_t;
+struct photo_src_t {
+    photo_header_t  hdr;	/* defines height and width          */
+    const uint16_t* pixels;	/* pixel data in file order          */
+    asset_view_t    view;	/* view of the file, if data != NULL */
+    uint16_t*       heap;	/* heap copy of pixels, or NULL      */
+};
+
+
+/* local functions--see function headers for details */
+static void decode_row (const photo_t* p, int32_t y, uint8_t* line);
+static const uint8_t* photo_row (const photo_t* p, int32_t y);
+static void photo_hline (const photo_t* p, int32_t x, int32_t y, int32_t n,
+			 uint8_t* out);
+static void photo_vline (const photo_t* p, int32_t x, int32_t y, int32_t n,
+			 uint8_t* out);
+static int transpose_photo (photo_t* p);
+static uint8_t* retile_photo (const photo_t* p, int to_tiles);
+static void release_img (photo_t* p);
+static int index_obj_image (image_t* im);
+static photo_t* load_photo (const char* fname, quantizer_t q);
+static photo_t* open_pano_photo (const char* fname);
+static void compress_photo (photo_t* p);
+static void apply_photo_settings (photo_t* p);
+static int open_asset (const char* fname, asset_view_t* view);
+static void close_asset (asset_view_t* view);
+static int open_photo_src (const char* fname, photo_src_t* src);
+static void close_photo_src (photo_src_t* src);
+static int qphoto_name (const char* fname, char* qname, size_t len);
+static photo_t* map_qphoto (asset_view_t* view, const struct stat* src_st,
+			    const uint64_t* src_hash, quantizer_t q);
+static int photo_cache_name (uint64_t src_hash, quantizer_t q, char* cname,
+			     size_t len);
+static void fill_photo_cache (const char* cname, const photo_t* p, 
+			      quantizer_t q, uint64_t src_hash);
+static int write_qphoto (FILE* out, const photo_t* p, const uint8_t* plane,
+			 quantizer_t q, uint64_t src_hash);
+
 
 /* file-scope variables */
 
@@ -110,6 +266,26 @@ typedef struct Octree {
  */
 static const room_t* cur_room = NULL; 
 
+/* 
+ * The photo of cur_room, looked up (see room_photo) once by prep_room 
+ * rather than on every line drawn.  The game calls prep_room again 
+ * whenever the room's photo may have changed (a new room, a swapped 
+ * photo, or a reloaded one).
+ */
+static photo_t* cur_view = NULL;
+
+/* 
+ * Decoded rows of compressed room photos.  Row y of the photo cached is
+ * held in line y % PHOTO_ROW_CACHE (tagged with y) when it is cached.
+ * Lines are as long as the photo's rows, so only the part of the cache
+ * in use is ever touched.  Photos may be read (and compressed) by other
+ * threads (see build_world), but the cache is only used by the thread
+ * that draws.
+ */
+static const photo_t* row_cache_photo = NULL;	/* photo being cached */
+static uint8_t        row_cache[PHOTO_ROW_CACHE * MAX_PHOTO_WIDTH];
+static int32_t        row_cache_tag[PHOTO_ROW_CACHE]; /* row in line  */
+
 /* 
  * fill_horiz_buffer
  *   DESCRIPTION: Given the (x,y) map pixel coordinate of the leftmost 
@@ -128,60 +304,66 @@ static const room_t* cur_room = NULL;
 void
 fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgx;  /* loop index over pixels in object image      */ 
-    int            yoff;  /* y offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
-    int32_t        obj_x; /* object x position                           */
-    int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
+    int               idx;   /* loop index over pixels in the line       */ 
+    obj_list_t        objs;  /* objects in room that may cover the line  */
+    int32_t           which; /* loop index over such objects             */
+    int               imgy;  /* row of object image on the line          */ 
+    int               dx;    /* x offset of object image from line       */
+    const uint8_t*    row;   /* pixels of object image row               */
+    const obj_span_t* span;  /* loop index over opaque spans in row      */
+    const obj_span_t* end;   /* end of opaque spans in row               */
+    const photo_t*    view;  /* room photo                               */
+    int32_t           obj_x; /* object x position                        */
+    int32_t           obj_y; /* object y position                        */
+    const image_t*    img;   /* object image                             */
+    int               last;  /* end of part of line to copy              */
 
     /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_X_DIM; idx++) {
-        buf[idx] = (0 <= x + idx && view->hdr.width > x + idx ?
-		    view->img[view->hdr.width * y + x + idx] : 0);
+    view = cur_view;
+
+    /* Copy the part of the line within the photo; the rest is black. */
+    (void)memset (buf, 0, SCROLL_X_DIM);
+    idx = (0 > x ? -x : 0);
+    last = (view->hdr.width < x + SCROLL_X_DIM ? 
+	    view->hdr.width - x : SCROLL_X_DIM);
+    if (idx < last) {
+        photo_hline (view, x + idx, y, last - idx, buf + idx);
     }
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
-	obj_x = obj_get_x (obj);
-	obj_y = obj_get_y (obj);
-	img = obj_image (obj);
+    /* Loop over objects in the current room that may cover the line. */
+    room_objects_on_row (cur_room, y, &objs);
+    for (which = 0; objs.num > which; which++) {
+	obj_x = objs.x[which];
+	obj_y = objs.y[which];
 
         /* Is object outside of the line we're drawing? */
-	if (y < obj_y || y >= obj_y + img->hdr.height ||
-	    x + SCROLL_X_DIM <= obj_x || x >= obj_x + img->hdr.width) {
+	if (y < obj_y || y >= obj_y + objs.height[which] ||
+	    x + SCROLL_X_DIM <= obj_x || x >= obj_x + objs.width[which]) {
 	    continue;
 	}
 
-	/* The y offset of drawing is fixed. */
-	yoff = (y - obj_y) * img->hdr.width;
+        /* Is its opaque part? */
+	img = objs.img[which];
+	imgy = y - obj_y;
+	if (imgy < img->box_top || imgy >= img->box_bottom ||
+	    x + SCROLL_X_DIM <= obj_x + img->box_left || 
+	    x >= obj_x + img->box_right) {
+	    continue;
+	}
 
 	/* 
-	 * The x offsets depend on whether the object starts to the left
-	 * or to the right of the starting point for the line being drawn.
+	 * Copy the opaque spans of the object's row, clipped to the line.
+	 * Pixel idx of the line is pixel idx - dx of the row.
 	 */
-	if (x <= obj_x) {
-	    idx = obj_x - x;
-	    imgx = 0;
-	} else {
-	    idx = 0;
-	    imgx = x - obj_x;
-	}
-
-	/* Copy the object's pixel data. */
-	for (; SCROLL_X_DIM > idx && img->hdr.width > imgx; idx++, imgx++) {
-	    pixel = img->img[yoff + imgx];
-
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
+	dx = obj_x - x;
+	row = img->img + img->stride * imgy;
+	end = img->span + img->row_span[imgy + 1];
+	for (span = img->span + img->row_span[imgy]; end > span; span++) {
+	    idx = (0 > dx + span->start ? 0 : dx + span->start);
+	    last = (SCROLL_X_DIM < dx + span->start + span->len ? 
+		    SCROLL_X_DIM : dx + span->start + span->len);
+	    if (idx < last) {
+	        (void)memcpy (buf + idx, row + idx - dx, last - idx);
 	    }
 	}
     }
@@ -206,62 +388,232 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 void
 fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 {
-    int            idx;   /* loop index over pixels in the line          */ 
-    object_t*      obj;   /* loop index over objects in the current room */
-    int            imgy;  /* loop index over pixels in object image      */ 
-    int            xoff;  /* x offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
-    int32_t        obj_x; /* object x position                           */
-    int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
+    int               idx;   /* loop index over pixels in the line       */ 
+    obj_list_t        objs;  /* objects in room that may cover the line  */
+    int32_t           which; /* loop index over such objects             */
+    int               imgx;  /* column of object image on the line       */ 
+    int               dy;    /* y offset of object image from line       */
+    const uint8_t*    col;   /* pixels of object image column            */
+    const obj_span_t* span;  /* loop index over opaque spans in column   */
+    const obj_span_t* end;   /* end of opaque spans in column            */
+    const photo_t*    view;  /* room photo                               */
+    int32_t           obj_x; /* object x position                        */
+    int32_t           obj_y; /* object y position                        */
+    const image_t*    img;   /* object image                             */
+    int               last;  /* end of part of line to copy              */
 
     /* Get pointer to current photo of current room. */
-    view = room_photo (cur_room);
-
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-		    view->img[view->hdr.width * (y + idx) + x] : 0);
+    view = cur_view;
+
+    /* Copy the part of the line within the photo; the rest is black. */
+    (void)memset (buf, 0, SCROLL_Y_DIM);
+    idx = (0 > y ? -y : 0);
+    last = (view->hdr.height < y + SCROLL_Y_DIM ? 
+	    view->hdr.height - y : SCROLL_Y_DIM);
+    if (idx < last) {
+        photo_vline (view, x, y + idx, last - idx, buf + idx);
     }
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
-	obj_x = obj_get_x (obj);
-	obj_y = obj_get_y (obj);
-	img = obj_image (obj);
+    /* Loop over objects in the current room that may cover the line. */
+    room_objects_on_column (cur_room, x, &objs);
+    for (which = 0; objs.num > which; which++) {
+	obj_x = objs.x[which];
+	obj_y = objs.y[which];
 
         /* Is object outside of the line we're drawing? */
-	if (x < obj_x || x >= obj_x + img->hdr.width ||
-	    y + SCROLL_Y_DIM <= obj_y || y >= obj_y + img->hdr.height) {
+	if (x < obj_x || x >= obj_x + objs.width[which] ||
+	    y + SCROLL_Y_DIM <= obj_y || y >= obj_y + objs.height[which]) {
 	    continue;
 	}
 
-	/* The x offset of drawing is fixed. */
-	xoff = x - obj_x;
+        /* Is its opaque part? */
+	img = objs.img[which];
+	imgx = x - obj_x;
+	if (imgx < img->box_left || imgx >= img->box_right ||
+	    y + SCROLL_Y_DIM <= obj_y + img->box_top || 
+	    y >= obj_y + img->box_bottom) {
+	    continue;
+	}
 
 	/* 
-	 * The y offsets depend on whether the object starts below or 
-	 * above the starting point for the line being drawn.
+	 * Copy the opaque spans of the object's column (from the copy of 
+	 * the image held column by column), clipped to the line.  Pixel 
+	 * idx of the line is pixel idx - dy of the column.
 	 */
-	if (y <= obj_y) {
-	    idx = obj_y - y;
-	    imgy = 0;
+	dy = obj_y - y;
+	col = img->cols + img->col_stride * imgx;
+	end = img->span + img->col_span[imgx + 1];
+	for (span = img->span + img->col_span[imgx]; end > span; span++) {
+	    idx = (0 > dy + span->start ? 0 : dy + span->start);
+	    last = (SCROLL_Y_DIM < dy + span->start + span->len ? 
+		    SCROLL_Y_DIM : dy + span->start + span->len);
+	    if (idx < last) {
+	        (void)memcpy (buf + idx, col + idx - dy, last - idx);
+	    }
+	}
+    }
+}
+
+
+/* 
+ * decode_row
+ *   DESCRIPTION: Decode one row of a compressed room photo (see 
+ *                compress_photo for the format).  Uses no shared state,
+ *                so any thread may call it.
+ *   INPUTS: p -- the compressed room photo
+ *           y -- the row (0 <= y < height)
+ *   OUTPUTS: line -- the row's pixels (width bytes)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+decode_row (const photo_t* p, int32_t y, uint8_t* line)
+{
+    uint8_t*       out;   /* next decoded pixel                */
+    const uint8_t* in;    /* next byte of compressed row       */
+    const uint8_t* end;   /* end of compressed row             */
+    uint32_t       n;     /* length of literal string or run   */
+
+    in = p->rle + p->row_start[y];
+    end = p->rle + p->row_start[y + 1];
+    for (out = line; end > in; out += n) {
+        if (128 > *in) {
+	    n = *in++ + 1;
+	    (void)memcpy (out, in, n);
+	    in += n;
 	} else {
-	    idx = 0;
-	    imgy = y - obj_y;
+	    n = *in++ - 125;
+	    (void)memset (out, *in++, n);
 	}
+    }
+}
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_Y_DIM > idx && img->hdr.height > imgy; idx++, imgy++) {
-	    pixel = img->img[xoff + img->hdr.width * imgy];
 
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
+/* 
+ * photo_row
+ *   DESCRIPTION: Find the pixels of one row of a room photo stored in 
+ *                rows (PHOTO_ROWS or PHOTO_DUAL).  Rows of a compressed
+ *                photo are decoded into the row cache.
+ *   INPUTS: p -- the room photo
+ *           y -- the row (0 <= y < height)
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the row's pixels (valid until the next call)
+ *   SIDE EFFECTS: may decode the row into the row cache
+ */
+static const uint8_t*
+photo_row (const photo_t* p, int32_t y)
+{
+    uint8_t* line;  /* cache line for the row */
+    int32_t  idx;   /* index over cache lines */
+
+    if (NULL != p->img) {
+        return p->img + p->hdr.width * y;
+    }
+
+    /* Start over when drawing a different photo. */
+    if (row_cache_photo != p) {
+	row_cache_photo = p;
+        for (idx = 0; PHOTO_ROW_CACHE > idx; idx++) {
+	    row_cache_tag[idx] = -1;
+	}
+    }
+    line = row_cache + (y % PHOTO_ROW_CACHE) * p->hdr.width;
+    if (y == row_cache_tag[y % PHOTO_ROW_CACHE]) {
+        return line;
+    }
+
+    /* Decode the row. */
+    decode_row (p, y, line);
+    row_cache_tag[y % PHOTO_ROW_CACHE] = y;
+    return line;
+}
+
+
+/* 
+ * photo_hline
+ *   DESCRIPTION: Copy part of a row of a room photo, whatever its layout.
+ *   INPUTS: p -- the room photo
+ *           (x,y) -- leftmost pixel to copy (within the photo)
+ *           n -- number of pixels to copy (x + n <= width)
+ *   OUTPUTS: out -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may decode a compressed row into the row cache
+ */
+static void
+photo_hline (const photo_t* p, int32_t x, int32_t y, int32_t n, uint8_t* out)
+{
+    int32_t len; /* pixels copied from one tile */
+
+    if (NULL != p->pano) {
+        pano_hline (p->pano, x, y, n, out);
+	return;
+    }
+    if (PHOTO_TILED == p->layout) {
+	for (; 0 < n; x += len, out += len, n -= len) {
+	    len = PHOTO_TILE - (x & PHOTO_TILE_MASK);
+	    if (len > n) {
+	        len = n;
 	    }
+	    (void)memcpy (out, p->img + TILED_OFFSET (p, x, y), len);
 	}
+	return;
+    }
+    (void)memcpy (out, photo_row (p, y) + x, n);
+}
+
+
+/* 
+ * photo_vline
+ *   DESCRIPTION: Copy part of a column of a room photo, whatever its 
+ *                layout.  The columns of a PHOTO_DUAL photo are built
+ *                the first time they are needed.
+ *   INPUTS: p -- the room photo
+ *           (x,y) -- top pixel to copy (within the photo)
+ *           n -- number of pixels to copy (y + n <= height)
+ *   OUTPUTS: out -- the pixels
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may decode compressed rows into the row cache; may 
+ *                 build the columns of a PHOTO_DUAL photo
+ */
+static void
+photo_vline (const photo_t* p, int32_t x, int32_t y, int32_t n, uint8_t* out)
+{
+    const uint8_t* in;	/* next pixel in tile        */
+    int32_t        len; /* pixels copied from a tile */
+    int32_t        idx; /* index over pixels in tile */
+
+    if (NULL != p->pano) {
+        pano_vline (p->pano, x, y, n, out);
+	return;
+    }
+    switch (p->layout) {
+	case PHOTO_TILED:
+	    for (; 0 < n; y += len, n -= len) {
+		len = PHOTO_TILE - (y & PHOTO_TILE_MASK);
+		if (len > n) {
+		    len = n;
+		}
+		in = p->img + TILED_OFFSET (p, x, y);
+		for (idx = 0; len > idx; idx++, in += PHOTO_TILE) {
+		    *out++ = *in;
+		}
+	    }
+	    return;
+
+	case PHOTO_DUAL:
+	    /* The columns are a cache, so build them even for a const photo. */
+	    if (NULL != p->cols || 0 == transpose_photo ((photo_t*)p)) {
+		(void)memcpy (out, p->cols + p->hdr.height * x + y, n);
+		return;
+	    }
+	    /* Out of memory: read the rows instead. */
+	    break;
+
+	default:
+	    break;
+    }
+    for (; 0 < n; n--, y++) {
+        *out++ = photo_row (p, y)[x];
     }
 }
 
@@ -325,6 +677,88 @@ photo_width (const photo_t* p)
 }
 
 
+/* 
+ * photo_memory
+ *   DESCRIPTION: Find the amount of memory used by a room photo: the
+ *                structure and its pixel data in whatever form they are
+ *                held (including mapped data and a panorama's tiles).
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes used
+ *   SIDE EFFECTS: none
+ */
+size_t
+photo_memory (const photo_t* p)
+{
+    size_t bytes = sizeof (*p); /* memory used so far */
+
+    if (NULL != p->img) {
+        bytes += (PHOTO_TILED == p->layout ?
+		  TILES_ACROSS (p) * 
+		  ((p->hdr.height + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT) *
+		  PHOTO_TILE * PHOTO_TILE : p->hdr.width * p->hdr.height);
+    }
+    if (NULL != p->rle) {
+        bytes += p->row_start[p->hdr.height] + 
+		 (p->hdr.height + 1) * sizeof (p->row_start[0]);
+    }
+    if (NULL != p->cols) {
+        bytes += p->hdr.width * p->hdr.height;
+    }
+    if (NULL != p->pano) {
+        bytes += pano_memory (p->pano);
+    }
+    return bytes;
+}
+
+
+/* 
+ * free_photo
+ *   DESCRIPTION: Release a room photo and all of its pixel data.  Must
+ *                be called by the thread that draws photos, as the 
+ *                photo may be in the row cache.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the photo; the pointer may no longer be used
+ */
+void
+free_photo (photo_t* p)
+{
+    if (row_cache_photo == p) {
+        row_cache_photo = NULL;
+    }
+    free_unshown_photo (p);
+}
+
+
+/* 
+ * free_unshown_photo
+ *   DESCRIPTION: Release a room photo that has never been drawn, and so
+ *                cannot be in the row cache.  May be called by any thread.
+ *   INPUTS: p -- room photo pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees the photo; the pointer may no longer be used
+ */
+void
+free_unshown_photo (photo_t* p)
+{
+    release_img (p);
+    if (NULL != p->rle) {
+        free (p->rle);
+	free (p->row_start);
+    }
+    if (NULL != p->cols) {
+        free (p->cols);
+    }
+    if (NULL != p->pano) {
+        close_panorama (p->pano);
+    }
+    free (p);
+}
+
+
 /*  changes 
  * prep_room
  *   DESCRIPTION: Prepare a new room for display.  You might want to set
@@ -333,12 +767,14 @@ photo_width (const photo_t* p)
  *   INPUTS: r -- pointer to the new room
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: changes recorded cur_room for this file
+ *   SIDE EFFECTS: changes recorded cur_room and cur_view for this file
  */
 void
 prep_room (const room_t* r)
 {
-	set_palette(room_photo(r)->palette); //last line of doc?? Finf this func: shoudl be a palette_RGB[192][3]?? prolly have to make look modex
+    /* Look up the room's photo for drawing. */
+    cur_view = room_photo (r);
+	set_palette(cur_view->palette); //last line of doc?? Finf this func: shoudl be a palette_RGB[192][3]?? prolly have to make look modex
     /* Record the current room. */
     cur_room = r;
 }
@@ -348,6 +784,11 @@ prep_room (const room_t* r)
  * read_obj_image
  *   DESCRIPTION: Read size and pixel data in 2:2:2 RGB format from a
  *                photo file and create an image structure from it.
+ *                The structure and its pixels share one block from the
+ *                asset arena (or from the heap if the arena is full), 
+ *                with each row starting on an ARENA_ALIGN boundary.
+ *                The opaque pixels are then indexed for drawing (see
+ *                index_obj_image).
  *   INPUTS: fname -- file name for input
  *   OUTPUTS: none
  *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
@@ -357,65 +798,610 @@ prep_room (const room_t* r)
 image_t*
 read_obj_image (const char* fname)
 {
-    FILE*    in;		/* input file               */
-    image_t* img = NULL;	/* image structure          */
-    uint16_t x;			/* index over image columns */
-    uint16_t y;			/* index over image rows    */
-    uint8_t  pixel;		/* one pixel from the file  */
+    asset_view_t   view;	/* view of the file contents   */
+    photo_header_t hdr;		/* image size                  */
+    image_t*       img = NULL;	/* image structure             */
+    const uint8_t* row;		/* current row of file pixels  */
+    uint32_t       stride;	/* padded length of image row  */
+    size_t         head_len;	/* structure length, padded    */
+    int32_t        on_heap;	/* block is not from the arena */
+    uint16_t       y;		/* index over image rows       */
 
     /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Open the file, read the header, do some sanity checks on it, and
+     * allocate space to hold the structure and the image pixels.  If 
+     * anything fails, clean up as necessary and return NULL.
      */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (img = malloc (sizeof (*img))) ||
-	NULL != (img->img = NULL) || /* false clause for initialization */
-	1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
-	MAX_OBJECT_WIDTH < img->hdr.width ||
-	MAX_OBJECT_HEIGHT < img->hdr.height ||
-	NULL == (img->img = malloc 
-		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
-	if (NULL != img) {
-	    if (NULL != img->img) {
-	        free (img->img);
-	    }
-	    free (img);
-	}
-	if (NULL != in) {
-	    (void)fclose (in);
-	}
+    if (0 != open_asset (fname, &view)) {
+        return NULL;
+    }
+    if (sizeof (hdr) > view.len ||
+	NULL == memcpy (&hdr, view.data, sizeof (hdr)) ||
+	MAX_OBJECT_WIDTH < hdr.width || MAX_OBJECT_HEIGHT < hdr.height ||
+	sizeof (hdr) + hdr.width * hdr.height > view.len) {
+	close_asset (&view);
+	return NULL;
+    }
+    stride = (hdr.width + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    head_len = (sizeof (*img) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    on_heap = (NULL == (img = arena_alloc (head_len + stride * hdr.height)));
+    if (on_heap && 0 != posix_memalign ((void**)&img, ARENA_ALIGN, 
+					head_len + stride * hdr.height)) {
+	close_asset (&view);
 	return NULL;
     }
+    img->hdr = hdr;
+    img->stride = stride;
+    img->img = (uint8_t*)img + head_len;
 
     /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
+     * Copy rows from bottom to top.  Note that the file is stored in
+     * this order, whereas in memory we store the data in the reverse
      * order (top to bottom).
      */
-    for (y = img->hdr.height; y-- > 0; ) {
-
-	/* Loop over columns from left to right. */
-	for (x = 0; img->hdr.width > x; x++) {
-
-	    /* 
-	     * Try to read one 8-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (img->img);
-		free (img);
-	        (void)fclose (in);
-		return NULL;
-	    }
+    row = view.data + sizeof (img->hdr);
+    for (y = img->hdr.height; y-- > 0; row += img->hdr.width) {
+        (void)memcpy (img->img + img->stride * y, row, img->hdr.width);
+    }
+    close_asset (&view);
 
-	    /* Store the pixel in the image data. */
-	    img->img[img->hdr.width * y + x] = pixel;
+    /* Find the opaque spans for drawing. */
+    if (0 != index_obj_image (img)) {
+	if (on_heap) {
+	    free (img);
 	}
+        return NULL;
     }
 
     /* All done.  Return success. */
+    return img;
+}
+
+
+/* 
+ * open_asset
+ *   DESCRIPTION: Set up a read-only view of the contents of an asset 
+ *                file.  An asset found in the asset pack (see pack.h) is
+ *                used in place; otherwise the file itself is mapped.
+ *   INPUTS: fname -- file name of the asset
+ *   OUTPUTS: view -- the view of the asset
+ *   RETURN VALUE: 0 on success, or -1 if the asset is not in the pack
+ *                 and its file cannot be mapped
+ *   SIDE EFFECTS: may map the file; release with close_asset
+ */
+static int
+open_asset (const char* fname, asset_view_t* view)
+{
+    int         fd;   /* asset file descriptor  */
+    struct stat st;   /* asset file status      */
+    void*       base; /* start of file mapping  */
+
+    view->map = NULL;
+    view->map_len = 0;
+    if (NULL != (view->data = find_asset (fname, &view->len))) {
+        return 0;
+    }
+    if (-1 == (fd = open (fname, O_RDONLY))) {
+        return -1;
+    }
+    if (0 != fstat (fd, &st) || !S_ISREG (st.st_mode) || 0 == st.st_size ||
+	MAP_FAILED == (base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, 
+				    fd, 0))) {
+	(void)close (fd);
+        return -1;
+    }
+    (void)close (fd);
+    view->data = base;
+    view->len = st.st_size;
+    view->map = base;
+    view->map_len = st.st_size;
+    return 0;
+}
+
+
+/* 
+ * close_asset
+ *   DESCRIPTION: Release a view set up by open_asset.
+ *   INPUTS: view -- the view of the asset
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unmaps the asset file, if it was mapped
+ */
+static void
+close_asset (asset_view_t* view)
+{
+    if (NULL != view->map) {
+        (void)munmap (view->map, view->map_len);
+	view->map = NULL;
+    }
+    view->data = NULL;
+}
+
+
+/* 
+ * open_photo_src
+ *   DESCRIPTION: Open a room photo file and set up a read-only view of
+ *                its 5:6:5 RGB pixel data.  The photo is used in place 
+ *                when possible (see open_asset), so the pixels are read
+ *                straight from the page cache without copying.  If that
+ *                fails (a pipe, for example), the pixels are instead read
+ *                into a packed 16-bit heap buffer.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: src -- the pixel source (header, pixels, and bookkeeping)
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: maps the file or allocates memory; release with
+ *                 close_photo_src
+ */
+static int
+open_photo_src (const char* fname, photo_src_t* src)
+{
+    FILE*  in;	     /* input stream (fallback path)   */
+    size_t num_pix;  /* number of pixels in the photo  */
+
+    src->pixels = NULL;
+    src->heap   = NULL;
+
+    /* Try to view the whole file; the header sits in front of the pixels. */
+    if (0 == open_asset (fname, &src->view)) {
+        if (sizeof (src->hdr) > src->view.len) {
+	    close_photo_src (src);
+	    return -1;
+	}
+	(void)memcpy (&src->hdr, src->view.data, sizeof (src->hdr));
+	num_pix = (size_t)src->hdr.width * src->hdr.height;
+	if (sizeof (src->hdr) + num_pix * sizeof (uint16_t) > src->view.len) {
+	    close_photo_src (src);
+	    return -1;
+	}
+
+	/* Both quantization passes walk the pixels in file order. */
+	if (NULL != src->view.map) {
+	    (void)madvise (src->view.map, src->view.map_len, MADV_SEQUENTIAL);
+	}
+	src->pixels = (const uint16_t*)(src->view.data + sizeof (src->hdr));
+	return 0;
+    }
+
+    /* Mapping failed: read the pixels into a packed heap buffer instead. */
+    if (NULL == (in = fopen (fname, "rb"))) {
+        return -1;
+    }
+    if (1 != fread (&src->hdr, sizeof (src->hdr), 1, in)) {
+        (void)fclose (in);
+	return -1;
+    }
+
+    /* An empty photo is legal, but has no pixels to read. */
+    num_pix = (size_t)src->hdr.width * src->hdr.height;
+    if (0 != num_pix &&
+        (NULL == (src->heap = malloc (num_pix * sizeof (uint16_t))) ||
+	 num_pix != fread (src->heap, sizeof (uint16_t), num_pix, in))) {
+	close_photo_src (src);
+	(void)fclose (in);
+	return -1;
+    }
     (void)fclose (in);
+    src->pixels = src->heap;
+    return 0;
+}
+
+
+/* 
+ * close_photo_src
+ *   DESCRIPTION: Release the pixel view set up by open_photo_src.
+ *   INPUTS: src -- the pixel source
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unmaps the file or frees the heap copy
+ */
+static void
+close_photo_src (photo_src_t* src)
+{
+    close_asset (&src->view);
+    if (NULL != src->heap) {
+        free (src->heap);
+	src->heap = NULL;
+    }
+    src->pixels = NULL;
+}
+
+
+/* 
+ * qphoto_name
+ *   DESCRIPTION: Find the name of the precompiled photo for a room photo
+ *                file: the ".photo" suffix is replaced with ".qphoto" (or
+ *                ".qphoto" is appended if the name has no such suffix).
+ *                The name of a precompiled photo is returned unchanged.
+ *   INPUTS: fname -- room photo file name
+ *           len -- size of qname buffer in bytes
+ *   OUTPUTS: qname -- precompiled photo file name
+ *   RETURN VALUE: 0 on success, or -1 if the name does not fit
+ *   SIDE EFFECTS: none
+ */
+static int
+qphoto_name (const char* fname, char* qname, size_t len)
+{
+    size_t base_len = strlen (fname); /* length of name without suffix */
+    size_t q_len = sizeof (QPHOTO_SUFFIX) - 1; /* length of suffix      */
+
+    if (q_len <= base_len && 
+        0 == strcmp (fname + base_len - q_len, QPHOTO_SUFFIX)) {
+        base_len -= q_len;
+    } else if (6 <= base_len && 0 == strcmp (fname + base_len - 6, ".photo")) {
+        base_len -= 6;
+    }
+    if (base_len + sizeof (QPHOTO_SUFFIX) > len) {
+        return -1;
+    }
+    (void)memcpy (qname, fname, base_len);
+    (void)strcpy (qname + base_len, QPHOTO_SUFFIX);
+    return 0;
+}
+
+
+/* 
+ * map_qphoto
+ *   DESCRIPTION: Load a precompiled photo (see qphoto_header_t) from a 
+ *                read-only view of its file.  No quantization is done:
+ *                the palette is copied out of the header and the photo
+ *                pixels are used in place, shared with the page cache.
+ *   INPUTS: view -- view of the precompiled photo file (see open_asset)
+ *           src_st -- status of the source room photo file, or NULL to
+ *                     skip the size and modification time check
+ *           src_hash -- hash of the source room photo, or NULL to skip
+ *                       the content check
+ *           q -- quantizer that must have built the file, or 
+ *                NUM_QUANTIZERS to accept any
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 if the file is damaged (its index plane does not match
+ *                 its checksum), stale, or was built with a different 
+ *                 quantizer
+ *   SIDE EFFECTS: dynamically allocates memory; the photo takes over the
+ *                 view on success, and the view is released on failure
+ */
+static photo_t*
+map_qphoto (asset_view_t* view, const struct stat* src_st, 
+	    const uint64_t* src_hash, quantizer_t q)
+{
+    const qphoto_header_t* qh;	 /* header at start of file      */
+    photo_t*               p;	 /* photo structure              */
+
+    /* Check the header against the file and the source photo. */
+    qh = (const qphoto_header_t*)view->data;
+    if (sizeof (*qh) > view->len ||
+	0 != memcmp (qh->magic, QPHOTO_MAGIC, sizeof (qh->magic)) ||
+	QUANTIZER_VERSION != qh->version ||
+	(NUM_QUANTIZERS != q && q != qh->quantizer) ||
+	MAX_PHOTO_WIDTH < qh->width || MAX_PHOTO_HEIGHT < qh->height ||
+	0 != qh->data_offset % QPHOTO_ALIGN || sizeof (*qh) > qh->data_offset ||
+	(size_t)qh->data_offset + (size_t)qh->width * qh->height > view->len ||
+	(NULL != src_st && 
+	 ((uint64_t)src_st->st_size != qh->src_size ||
+	  QPHOTO_MTIME (src_st) != qh->src_mtime)) ||
+	(NULL != src_hash && *src_hash != qh->src_hash) ||
+	qh->data_sum != photo_hash (view->data + qh->data_offset,
+				    (size_t)qh->width * qh->height) ||
+	NULL == (p = malloc (sizeof (*p)))) {
+        close_asset (view);
+	return NULL;
+    }
+    p->hdr.width = qh->width;
+    p->hdr.height = qh->height;
+    (void)memcpy (p->palette, qh->palette, sizeof (p->palette));
+    p->img = (uint8_t*)view->data + qh->data_offset;
+    p->map = view->map;
+    p->map_len = view->map_len;
+    p->img_on_heap = 0;
+    p->rle = NULL;
+    p->row_start = NULL;
+    p->layout = PHOTO_ROWS;
+    p->cols = NULL;
+    p->pano = NULL;
+    p->quantizer = qh->quantizer;
+    return p;
+}
+
+
+/* 
+ * photo_cache_dir
+ *   DESCRIPTION: Find the directory holding cached photos, PHOTO_CACHE_DIR
+ *                or the one named by PHOTO_CACHE_ENV.  The directory is
+ *                created if need be.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the directory name, or NULL if the cache is turned off
+ *   SIDE EFFECTS: may create the cache directory
+ */
+const char*
+photo_cache_dir ()
+{
+    const char* dir; /* cache directory */
+
+    if (NULL == (dir = getenv (PHOTO_CACHE_ENV))) {
+        dir = PHOTO_CACHE_DIR;
+    }
+    if ('\0' == *dir) {
+        return NULL;
+    }
+    (void)mkdir (dir, 0777);
+    return dir;
+}
+
+
+/* 
+ * photo_cache_name
+ *   DESCRIPTION: Find the name of the cache entry for a room photo 
+ *                quantized with a given quantizer.  Entries are named
+ *                by the hash of the photo's contents, the quantizer, and
+ *                the quantizer version, so a changed photo or quantizer
+ *                simply misses.
+ *   INPUTS: src_hash -- hash of the room photo (photo_source_hash)
+ *           q -- the quantizer
+ *           len -- size of cname buffer in bytes
+ *   OUTPUTS: cname -- cache entry file name
+ *   RETURN VALUE: 0 on success, or -1 if the cache is turned off or 
+ *                 the name does not fit
+ *   SIDE EFFECTS: may create the cache directory
+ */
+static int
+photo_cache_name (uint64_t src_hash, quantizer_t q, char* cname, size_t len)
+{
+    const char* dir; /* cache directory */
+    int         n;   /* length of name  */
+
+    if (NULL == (dir = photo_cache_dir ())) {
+        return -1;
+    }
+    n = snprintf (cname, len, "%s/%016llx-%s-v%d%s", dir, 
+		  (unsigned long long)src_hash, quantizer_name (q),
+		  QUANTIZER_VERSION, QPHOTO_SUFFIX);
+    return ((0 > n || (size_t)n >= len) ? -1 : 0);
+}
+
+
+/* 
+ * fill_photo_cache
+ *   DESCRIPTION: Write a newly quantized room photo into the cache as a
+ *                precompiled photo.  The entry is written to a temporary
+ *                file that is then renamed into place, so other players
+ *                never see a partial entry.  Failures are ignored: the 
+ *                photo will just be quantized again next time.
+ *   INPUTS: cname -- cache entry file name (from photo_cache_name)
+ *           p -- the quantized photo
+ *           q -- quantizer used
+ *           src_hash -- hash of the room photo (photo_source_hash)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes a file in the cache directory
+ */
+static void
+fill_photo_cache (const char* cname, const photo_t* p, quantizer_t q,
+		  uint64_t src_hash)
+{
+    static uint32_t serial = 0;  /* makes temporary names unique */
+    char            tname[1024]; /* temporary file name        */
+    FILE*           out;	 /* temporary file             */
+    int             written;     /* temporary file is complete */
+    uint32_t        tmp_id;      /* serial number of temp file */
+
+    /* Threads of this process may be filling the same entry at once. */
+    tmp_id = __sync_fetch_and_add (&serial, 1);
+    if (sizeof (tname) <= (size_t)snprintf (tname, sizeof (tname), 
+    					     "%s.%d.%u.tmp", cname, getpid (),
+					     tmp_id) ||
+        NULL == (out = fopen (tname, "wb"))) {
+        return;
+    }
+    written = (0 == write_qphoto (out, p, p->img, q, src_hash));
+    if (EOF == fclose (out) || !written || 0 != rename (tname, cname)) {
+        (void)unlink (tname);
+    }
+}
+
+
+/* 
+ * write_qphoto
+ *   DESCRIPTION: Write a quantized room photo to a file as a precompiled
+ *                photo (see qphoto_header_t), starting at the current 
+ *                position.  The index plane is aligned to QPHOTO_ALIGN
+ *                relative to the start of the header.
+ *   INPUTS: out -- file to write
+ *           p -- the quantized photo
+ *           plane -- its pixels, row by row from the top
+ *           q -- quantizer used
+ *           src_hash -- hash of the room photo (photo_source_hash)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if a write fails
+ *   SIDE EFFECTS: writes to the file
+ */
+static int
+write_qphoto (FILE* out, const photo_t* p, const uint8_t* plane, 
+	      quantizer_t q, uint64_t src_hash)
+{
+    static const uint8_t zeros[QPHOTO_ALIGN];
+    qphoto_header_t      qh;	      /* header of precompiled photo */
+    size_t               num_pix;     /* number of pixels in photo   */
+
+    num_pix = (size_t)p->hdr.width * p->hdr.height;
+    (void)memset (&qh, 0, sizeof (qh));
+    (void)memcpy (qh.magic, QPHOTO_MAGIC, sizeof (qh.magic));
+    qh.width = p->hdr.width;
+    qh.height = p->hdr.height;
+    qh.quantizer = q;
+    qh.version = QUANTIZER_VERSION;
+    qh.data_offset = (sizeof (qh) + QPHOTO_ALIGN - 1) & ~(QPHOTO_ALIGN - 1);
+    qh.src_hash = src_hash;
+    qh.data_sum = photo_hash (plane, num_pix);
+    (void)memcpy (qh.palette, p->palette, sizeof (qh.palette));
+    return ((1 == fwrite (&qh, sizeof (qh), 1, out) &&
+	     1 == fwrite (zeros, qh.data_offset - sizeof (qh), 1, out) &&
+	     num_pix == fwrite (plane, 1, num_pix, out)) ? 0 : -1);
+}
+
+
+/* 
+ * save_photo
+ *   DESCRIPTION: Write a room photo to a file as a precompiled photo 
+ *                (see write_qphoto), whatever its layout, so that it can
+ *                later be used in place with restore_photo.  Compressed
+ *                rows and tiles are copied into a private plane rather
+ *                than through the row cache, so any thread may save a 
+ *                photo while another draws it.  Panoramas have no index
+ *                plane in memory and cannot be saved.
+ *   INPUTS: out -- file to write
+ *           p -- the room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 on failure
+ *   SIDE EFFECTS: writes to the file
+ */
+int32_t
+save_photo (FILE* out, const photo_t* p)
+{
+    uint8_t* plane;	/* pixels, row by row from the top */
+    uint8_t* line;	/* row of plane being filled       */
+    int32_t  x;		/* index over tiles in a row       */
+    int32_t  y;		/* index over photo rows           */
+    int32_t  len;	/* pixels copied from a tile       */
+    int32_t  rval;	/* return value                    */
+
+    if (NULL != p->pano) {
+        return -1;
+    }
+    if (NULL != p->img && PHOTO_TILED != p->layout) {
+        return write_qphoto (out, p, p->img, p->quantizer, 0);
+    }
+    if (NULL == (plane = malloc ((size_t)p->hdr.width * p->hdr.height))) {
+        return -1;
+    }
+    for (y = 0; p->hdr.height > y; y++) {
+	line = plane + p->hdr.width * y;
+        if (NULL == p->img) {
+	    decode_row (p, y, line);
+	    continue;
+	}
+	for (x = 0; p->hdr.width > x; x += len) {
+	    len = PHOTO_TILE - (x & PHOTO_TILE_MASK);
+	    if (len > p->hdr.width - x) {
+	        len = p->hdr.width - x;
+	    }
+	    (void)memcpy (line + x, p->img + TILED_OFFSET (p, x, y), len);
+	}
+    }
+    rval = write_qphoto (out, p, plane, p->quantizer, 0);
+    free (plane);
+    return rval;
+}
+
+
+/* 
+ * restore_photo
+ *   DESCRIPTION: Create a room photo from a precompiled photo written
+ *                by save_photo into memory that stays mapped until the
+ *                program ends.  The pixels are used in place.  The photo
+ *                is then compressed or given a layout as in 
+ *                read_photo_with_quantizer.
+ *   INPUTS: data -- the precompiled photo
+ *           len -- its length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 if the data are damaged
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+photo_t*
+restore_photo (const void* data, size_t len)
+{
+    asset_view_t view;	/* view of the precompiled photo */
+    photo_t*     p;	/* photo structure               */
+
+    view.data = data;
+    view.len = len;
+    view.map = NULL;
+    view.map_len = 0;
+    if (NULL != (p = map_qphoto (&view, NULL, NULL, NUM_QUANTIZERS))) {
+        apply_photo_settings (p);
+    }
+    return p;
+}
+
+
+/* 
+ * save_obj_image
+ *   DESCRIPTION: Write an object image to a file so that it can later
+ *                be used in place with restore_obj_image: the image
+ *                header, the hash of the rows (at OBJ_SAVE_SUM), padding
+ *                to ARENA_ALIGN, and the padded rows from top to bottom.
+ *   INPUTS: out -- file to write
+ *           im -- the object image
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if a write fails
+ *   SIDE EFFECTS: writes to the file
+ */
+int32_t
+save_obj_image (FILE* out, const image_t* im)
+{
+    uint8_t  head[ARENA_ALIGN]; /* header, hash, and padding */
+    size_t   n_bytes;	        /* length of padded rows     */
+    uint64_t sum;	        /* hash of the rows          */
+
+    n_bytes = (size_t)im->stride * im->hdr.height;
+    sum = photo_hash (im->img, n_bytes);
+    (void)memset (head, 0, sizeof (head));
+    (void)memcpy (head, &im->hdr, sizeof (im->hdr));
+    (void)memcpy (head + OBJ_SAVE_SUM, &sum, sizeof (sum));
+    return ((1 == fwrite (head, sizeof (head), 1, out) &&
+	     n_bytes == fwrite (im->img, 1, n_bytes, out)) ? 0 : -1);
+}
+
+
+/* 
+ * restore_obj_image
+ *   DESCRIPTION: Create an object image from data written by 
+ *                save_obj_image into memory that stays mapped until the
+ *                program ends.  The pixels are used in place; only the
+ *                structure and the index of its opaque pixels (see 
+ *                index_obj_image) are allocated (from the asset arena,
+ *                or from the heap if the arena is full).
+ *   INPUTS: data -- the saved image, aligned to ARENA_ALIGN
+ *           len -- its length in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated image on success, or NULL
+ *                 if the data are damaged (including a mismatched hash)
+ *   SIDE EFFECTS: dynamically allocates memory for the image
+ */
+image_t*
+restore_obj_image (const void* data, size_t len)
+{
+    photo_header_t hdr;		/* image size                  */
+    image_t*       img;		/* image structure             */
+    uint32_t       stride;	/* padded length of image row  */
+    uint64_t       sum;		/* hash of rows when saved     */
+    int32_t        on_heap;	/* structure is not from arena */
+
+    if (ARENA_ALIGN > len || NULL == memcpy (&hdr, data, sizeof (hdr)) ||
+        MAX_OBJECT_WIDTH < hdr.width || MAX_OBJECT_HEIGHT < hdr.height) {
+        return NULL;
+    }
+    stride = (hdr.width + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    (void)memcpy (&sum, (const uint8_t*)data + OBJ_SAVE_SUM, sizeof (sum));
+    if (ARENA_ALIGN + (size_t)stride * hdr.height > len ||
+        sum != photo_hash ((const uint8_t*)data + ARENA_ALIGN,
+			   (size_t)stride * hdr.height)) {
+        return NULL;
+    }
+    on_heap = (NULL == (img = arena_alloc (sizeof (*img))));
+    if (on_heap && NULL == (img = malloc (sizeof (*img)))) {
+        return NULL;
+    }
+    img->hdr = hdr;
+    img->stride = stride;
+    img->img = (uint8_t*)data + ARENA_ALIGN;
+    if (0 != index_obj_image (img)) {
+	if (on_heap) {
+	    free (img);
+	}
+        return NULL;
+    }
     return img;
 }
 
@@ -423,11 +1409,8 @@ read_obj_image (const char* fname)
 /* 
  * read_photo
  *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
- *                photo file and create a photo structure from it.
- *                Code provided simply maps to 2:2:2 RGB.  You must
- *                replace this code with palette color selection, and
- *                must map the image pixels into the palette colors that
- *                you have defined.
+ *                photo file and create a photo structure from it, 
+ *                using the default quantizer (see default_quantizer).
  *   INPUTS: fname -- file name for input
  *   OUTPUTS: none
  *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
@@ -437,326 +1420,677 @@ read_obj_image (const char* fname)
 photo_t*
 read_photo (const char* fname)
 {
-    FILE*    in;	/* input file               */
-    photo_t* p = NULL;	/* photo structure          */
-    uint16_t x;		/* index over image columns */
-    uint16_t y;		/* index over image rows    */
-    uint16_t pixel;	/* one pixel from the file  */
+    return read_photo_with_quantizer (fname, default_quantizer ());
+}
+
+
+/* 
+ * read_photo_with_quantizer
+ *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
+ *                photo file and create a photo structure from it (see
+ *                load_photo), using the given quantizer.  The photo is
+ *                then compressed if photos are to be kept compressed, or
+ *                else given the layout named in the environment.
+ *   INPUTS: fname -- file name for input
+ *           q -- quantizer used to pick the palette
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+photo_t*
+read_photo_with_quantizer (const char* fname, quantizer_t q)
+{
+    photo_t* p;	/* photo structure */
+
+    if (NULL != (p = load_photo (fname, q))) {
+        apply_photo_settings (p);
+    }
+    return p;
+}
+
+
+/* 
+ * apply_photo_settings
+ *   DESCRIPTION: Compress a newly read room photo if photos are to be
+ *                kept compressed, or else give it the layout named in
+ *                the environment.
+ *   INPUTS: p -- the room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the photo's pixel data
+ */
+static void
+apply_photo_settings (photo_t* p)
+{
+    static const char* const layout_name[NUM_PHOTO_LAYOUTS] = {
+        "rows", "tiled", "dual"
+    };
+    const char* env;	/* compression or layout setting, if any */
+    int32_t     layout; /* index over layouts                   */
+
+    if (NULL != (env = getenv (COMPRESS_PHOTOS_ENV)) ? 
+	0 != atoi (env) : 0 != COMPRESS_PHOTOS) {
+        compress_photo (p);
+    } else if (NULL != (env = getenv (PHOTO_LAYOUT_ENV))) {
+        for (layout = 0; NUM_PHOTO_LAYOUTS > layout; layout++) {
+	    if (0 == strcasecmp (env, layout_name[layout])) {
+	        (void)set_photo_layout (p, layout);
+	    }
+	}
+    }
+}
+
+
+/* 
+ * read_photo_header
+ *   DESCRIPTION: Find the size of the photo that read_photo would read
+ *                from a file, without reading the photo.  The file may 
+ *                be a photo, a precompiled photo, or a panorama, and may
+ *                be in the asset pack.  The file must also be long 
+ *                enough to hold all of the pixels its header promises,
+ *                so that a truncated photo is caught when the world is 
+ *                built rather than when the room is first shown.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: hdr -- the photo's size
+ *   RETURN VALUE: 0 on success, or -1 if the file cannot be read, does
+ *                 not hold a photo of an acceptable size, or is short
+ *   SIDE EFFECTS: none
+ */
+int32_t
+read_photo_header (const char* fname, photo_header_t* hdr)
+{
+    asset_view_t           view;	/* view of the file contents  */
+    const qphoto_header_t* qh;		/* header of precompiled file */
+    const qpan_header_t*   ph;		/* header of panorama file    */
+    int32_t                max_w;	/* largest acceptable width   */
+    int32_t                max_h;	/* largest acceptable height  */
+    uint64_t               need;	/* length of a complete file  */
+
+    if (0 != open_asset (fname, &view)) {
+        return -1;
+    }
+    qh = (const qphoto_header_t*)view.data;
+    ph = (const qpan_header_t*)view.data;
+    max_w = MAX_PHOTO_WIDTH;
+    max_h = MAX_PHOTO_HEIGHT;
+    if (sizeof (*qh) <= view.len && 
+        0 == memcmp (qh->magic, QPHOTO_MAGIC, sizeof (qh->magic))) {
+        hdr->width = qh->width;
+	hdr->height = qh->height;
+	need = (uint64_t)qh->data_offset + (uint64_t)qh->width * qh->height;
+    } else if (sizeof (*ph) <= view.len && 
+	       0 == memcmp (ph->magic, QPAN_MAGIC, sizeof (ph->magic))) {
+        hdr->width = ph->width;
+	hdr->height = ph->height;
+	max_w = PANO_MAX_WIDTH;
+	max_h = PANO_MAX_HEIGHT;
+	need = (uint64_t)ph->data_offset + 
+	       ((uint64_t)1 << (2 * QPAN_TILE_SHIFT)) *
+	       ((ph->width + (1 << QPAN_TILE_SHIFT) - 1) >> QPAN_TILE_SHIFT) *
+	       ((ph->height + (1 << QPAN_TILE_SHIFT) - 1) >> QPAN_TILE_SHIFT);
+    } else if (sizeof (*hdr) <= view.len) {
+        (void)memcpy (hdr, view.data, sizeof (*hdr));
+	need = sizeof (*hdr) + 
+	       (uint64_t)hdr->width * hdr->height * sizeof (uint16_t);
+    } else {
+	max_w = -1;
+	need = 0;
+    }
+    if (need > view.len) {
+        max_w = -1;
+    }
+    close_asset (&view);
+    return (max_w >= hdr->width && max_h >= hdr->height ? 0 : -1);
+}
+
+
+/* 
+ * load_photo
+ *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
+ *                photo file and create a photo structure from it.
+ *                If an up-to-date precompiled photo built with the same
+ *                quantizer sits next to the file (see qphoto_name), or 
+ *                if fname names a precompiled photo, that file is simply
+ *                mapped.  Failing that, the quantized photo is mapped 
+ *                from the cache (see photo_cache_name) if it is there.
+ *                Otherwise, the palette is chosen with the given 
+ *                quantizer, the image pixels are then mapped into the
+ *                palette, and the result is added to the cache.  The
+ *                file is quantized in two passes over a read-only view
+ *                of its pixels (see open_photo_src), so the only working
+ *                memory is the quantizer's fixed-size octree, independent
+ *                of the size of the photo.
+ *   INPUTS: fname -- file name for input
+ *           q -- quantizer used to pick the palette
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo; may add
+ *                 an entry to the cache or discard a damaged one
+ */
+static photo_t*
+load_photo (const char* fname, quantizer_t q)
+{
+    photo_src_t  src;		/* view of the photo file's pixels  */
+    photo_t*     p = NULL;	/* photo structure                  */
+    asset_view_t view;		/* view of a precompiled photo      */
+    struct stat  st;		/* photo file status                */
+    char         qname[1024];	/* name of precompiled photo file   */
+    char         cname[1024];	/* name of cache entry              */
+    uint64_t     src_hash;	/* hash of photo file contents      */
+    int          use_cache = 0;	/* cache entry name is known        */
+    size_t       len;		/* length of file name              */
+
+    /* A panorama is never loaded, only opened (see pano.c). */
+    len = strlen (fname);
+    if (sizeof (QPAN_SUFFIX) - 1 <= len &&
+        0 == strcmp (fname + len - (sizeof (QPAN_SUFFIX) - 1), QPAN_SUFFIX)) {
+        return open_pano_photo (fname);
+    }
+
+    /* 
+     * Use a precompiled photo when one is available.  One in the asset
+     * pack was packed along with its source, so it cannot be stale.
+     */
+    if (0 == qphoto_name (fname, qname, sizeof (qname)) &&
+        0 == open_asset (qname, &view)) {
+        if (0 == strcmp (fname, qname)) {
+	    return map_qphoto (&view, NULL, NULL, NUM_QUANTIZERS);
+	}
+	if (NULL == view.map) {
+	    p = map_qphoto (&view, NULL, NULL, q);
+	} else if (0 == stat (fname, &st)) {
+	    p = map_qphoto (&view, &st, NULL, q);
+	} else {
+	    close_asset (&view);
+	}
+	if (NULL != p) {
+	    return p;
+	}
+    }
 
     /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Open the file, allocate the structure, do some sanity checks on
+     * the header, and allocate space to hold the photo pixels.  If 
+     * anything fails, clean up as necessary and return NULL.
      */
-    if (NULL == (in = fopen (fname, "r+b")) ||
+    if (0 != open_photo_src (fname, &src)) {
+        return NULL;
+    }
+
+    /* 
+     * Then look in the cache.  Any entry with this name that cannot be
+     * used is damaged, so throw it out.
+     */
+    if (MAX_PHOTO_WIDTH >= src.hdr.width && 
+        MAX_PHOTO_HEIGHT >= src.hdr.height) {
+	src_hash = photo_source_hash (&src.hdr, src.pixels);
+	use_cache = (NUM_QUANTIZERS > (uint32_t)q && 
+		     0 == photo_cache_name (src_hash, q, cname, 
+		     			    sizeof (cname)));
+	if (use_cache && 0 == open_asset (cname, &view)) {
+	    if (NULL != (p = map_qphoto (&view, NULL, &src_hash, q))) {
+		close_photo_src (&src);
+		return p;
+	    }
+	    (void)unlink (cname);
+	}
+    }
+
+    if (MAX_PHOTO_WIDTH < src.hdr.width ||
+	MAX_PHOTO_HEIGHT < src.hdr.height ||
 	NULL == (p = malloc (sizeof (*p))) ||
 	NULL != (p->img = NULL) || /* false clause for initialization */
-	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
-	MAX_PHOTO_WIDTH < p->hdr.width ||
-	MAX_PHOTO_HEIGHT < p->hdr.height ||
 	NULL == (p->img = malloc 
-		 (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
+		 (src.hdr.width * src.hdr.height * sizeof (p->img[0]))) ||
+	0 != quantize_photo (q, &src.hdr, src.pixels, p->palette, p->img)) {
 	if (NULL != p) {
 	    if (NULL != p->img) {
 	        free (p->img);
 	    }
 	    free (p);
 	}
-	if (NULL != in) {
-	    (void)fclose (in);
-	}
+	close_photo_src (&src);
 	return NULL;
     }
+    p->hdr = src.hdr;
+    p->map = NULL;
+    p->map_len = 0;
+    p->img_on_heap = 1;
+    p->rle = NULL;
+    p->row_start = NULL;
+    p->layout = PHOTO_ROWS;
+    p->cols = NULL;
+    p->pano = NULL;
+    p->quantizer = q;
+    if (use_cache) {
+        fill_photo_cache (cname, p, q, src_hash);
+    }
 
-//////////////////////////////////////////////////////////////////////////me//////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////me boo////////////////////////////////////////////////////////////////////////
-		Octree Tree = create_Octree(); //initialize the octree i made
-		uint32_t color_12_bit;
-		uint32_t color_6_bit;
-		uint32_t Red,Green,Blue;
-		uint32_t numPixels = p->hdr.width * p->hdr.height;
-		uint32_t array_of_image[numPixels]; // array with all pixels making image!
-		uint32_t Level4_idx; //index on level 4 will need this at sorting stage!
-////////////////////////////////////////////////////////////////////////me boo////////////////////////////////////////////////////////////////////////
-	/*  
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = p->hdr.height; y-- > 0; ) {
-	/* Loop over columns from left to right. */
-		for (x = 0; p->hdr.width > x; x++) {
-
-	    /* 
-	     * Try to read one 16-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (p->img);
-		free (p);
-	        (void)fclose (in);
-		return NULL;
-
-	    }
-
-		/*
-		The first step in the algorithm requires that you count the number of pixels in each node at level four of an octree. Define a structure for 
-		all relevant data for a level-four octree node, then create an array of that structure for your algorithm. Go through the pixels in the image
-		file, map them into the appropriate octree node, and count them up.
-		*/
-		array_of_image[p->hdr.width * y + x] = pixel; //exact position: offset from currnt row + what column ie. position in array to store pixel
-
-		color_12_bit = convert16_to_12(pixel); // my helper function
-
-		// Extract Red, Green, and Blue components
-        Red = extractRed(pixel); //helper
-        Green = extractGreen(pixel); //helper 
-        Blue = extractBlue(pixel); //helper
-
-        // Updating the Octree data structure i made
-		Tree.Level4[color_12_bit].count +=1;
-		Tree.Level4[color_12_bit].Sum_R += Red;
-		Tree.Level4[color_12_bit].Sum_G += Green;
-		Tree.Level4[color_12_bit].Sum_B += Blue;
-
-	    /* take this out as a whole and deal with level 4 of octree???? -----pranav
-	     * 16-bit pixel is coded as 5:6:5 RGB (5 bits red, 6 bits green,
-	     * and 6 bits blue).  We change to 2:2:2, which we've set for the
-	     * game objects.  You need to use the other 192 palette colors
-	     * to specialize the appearance of each photo.
-	     *
-	     * In this code, you need to calculate the p->palette values,
-	     * which encode 6-bit RGB as arrays of three uint8_t's.  When
-	     * the game puts up a photo, you should then change the palette 
-	     * to match the colors needed for that photo.
-	     */
-// 	    p->img[p->hdr.width * y + x] = (((pixel >> 14) << 4) |
-// 					    (((pixel >> 9) & 0x3) << 2) |
-// 					    ((pixel >> 3) & 0x3));
-	}
-}
-
-	int i;
-	int L2_index;
-	// Sort the Level4 array
-	qsort((Octree_Node*)Tree.Level4, 4096, sizeof(Tree.Level4[0]), compareFunction);
-
-	// Set up the palette
-	for (i = 0; i < 4096; i++) {
-		// Record the sorted index
-		int currentRGB = Tree.Level4[i].RGB;
-		Tree.Level4[currentRGB].sorted_index = i;
-		
-		if (i < 128) {
-			// Set up the first 128 colors of the palette (L4)
-			if (Tree.Level4[i].count == 0) {
-				break;
-			}
-		double count_inverse = 1.0 / Tree.Level4[i].count; //got some crazy divide bby zero error. bug log
-		p->palette[i][0] = Tree.Level4[i].Sum_R * count_inverse;
-		p->palette[i][1] = Tree.Level4[i].Sum_G * count_inverse;
-		p->palette[i][2] = Tree.Level4[i].Sum_B * count_inverse;
-		}
-	}
-
-	// Use the remaining L4 colors to set up L2
-	for (i = 128; i < 4096; i++) {
-		if (Tree.Level4[i].count == 0) {
-			continue;
-		}
-		
-		// Calculate L2_index once
-		L2_index = convert12_to_6(Tree.Level4[i].RGB);
-		
-		Tree.Level2[L2_index].Sum_R += Tree.Level4[i].Sum_R;
-		Tree.Level2[L2_index].Sum_G += Tree.Level4[i].Sum_G;
-		Tree.Level2[L2_index].Sum_B += Tree.Level4[i].Sum_B;
-		Tree.Level2[L2_index].count += Tree.Level4[i].count;
-	}
-
-	// Set up the last 64 colors of the palette (L2)
-	for (i = 0; i < 64; i++) {
-		if (Tree.Level2[i].count == 0) {
-			continue;
-		}
-		
-		int paletteIndex = i + 128;
-		double count_inverse = 1.0 / Tree.Level2[i].count;
-		p->palette[paletteIndex][0] = Tree.Level2[i].Sum_R * count_inverse;
-		p->palette[paletteIndex][1] = Tree.Level2[i].Sum_G * count_inverse;
-		p->palette[paletteIndex][2] = Tree.Level2[i].Sum_B * count_inverse;
-	}
-
-	// Loop over each pixel in the image
-	for (y = p->hdr.height; y-- > 0;) {
-		for (x = 0; p->hdr.width > x; x++) {
-			// Get the pixel from the array_of_image
-			pixel = array_of_image[p->hdr.width * y + x];
-
-			// Convert the pixel into 12 and 6-bit color types
-			color_12_bit = convert16_to_12(pixel);
-			color_6_bit = convert12_to_6(color_12_bit);
-
-			// Find the sorted index of the color in Level4
-			Level4_idx = Tree.Level4[color_12_bit].sorted_index;
-
-			// Assign it to the appropriate range
-			if (Level4_idx < 128) {
-				// Assign to range [64, 191]
-				p->img[p->hdr.width * y + x] = (char)(64 + Level4_idx);
-			} else {
-				// Assign to range [192, 255]
-				p->img[p->hdr.width * y + x] = (char)(64 + 128 + color_6_bit);
-			}
-		}
-	}
-
-	//     /* All done.  Return success. */
-		(void)fclose (in);
-		return p;
-	}
-
-//////////////////////////////////////////////////////////////////////////me//////////////////////////////////////////////////////////////////////////
-
+    /* All done.  Return success. */
+    close_photo_src (&src);
+    return p;
+}
 
-////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
 
 /* 
-   Interface Description:
-   This function creates and initializes an Octree structure for color quantization purposes.
-   The Octree consists of two levels: Level2 and Level4, with Level2 containing 64 nodes and Level4 containing 4096 nodes.
-   Each node in the Octree_Node structure stores color information (RGB), sums of color components (Sum_R, Sum_G, Sum_B),
-   a count of the number of colors represented by the node (count).
+ * open_pano_photo
+ *   DESCRIPTION: Open a panorama file (see qpan_header_t) as a room 
+ *                photo.  Panoramas may be far larger than other photos
+ *                (up to PANO_MAX_WIDTH by PANO_MAX_HEIGHT) and are never
+ *                held in memory as a whole: photo_hline and photo_vline
+ *                read their pixels through a bounded tile cache.
+ *                Panoramas are only read from files, never from the
+ *                asset pack.
+ *   INPUTS: fname -- panorama file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo and its
+ *                 tile cache; starts the panorama's reader thread
+ */
+static photo_t*
+open_pano_photo (const char* fname)
+{
+    photo_t* p; /* photo structure */
 
-   Returns:
-   An initialized Octree structure.
-*/
+    if (NULL == (p = malloc (sizeof (*p)))) {
+        return NULL;
+    }
+    if (NULL == (p->pano = open_panorama (fname, &p->hdr, p->palette))) {
+        free (p);
+	return NULL;
+    }
+    if (PANO_MAX_WIDTH < p->hdr.width || PANO_MAX_HEIGHT < p->hdr.height) {
+        close_panorama (p->pano);
+        free (p);
+	return NULL;
+    }
+    p->img = NULL;
+    p->map = NULL;
+    p->map_len = 0;
+    p->img_on_heap = 0;
+    p->rle = NULL;
+    p->row_start = NULL;
+    p->layout = PHOTO_ROWS;
+    p->cols = NULL;
+    p->quantizer = NUM_QUANTIZERS; /* panoramas are never saved */
+    return p;
+}
 
-// Function to create and initialize an octree node
-Octree create_Octree() {
-    // Allocate memory for the Octree structure
-    Octree Tree;
-    int i;
 
-    // Initialize both level 2 nodes
-    for (i = 0; i < 64; i++) {
-        Tree.Level2[i].count = 0;
-        Tree.Level2[i].Sum_R = 0;
-        Tree.Level2[i].Sum_G = 0;
-        Tree.Level2[i].Sum_B = 0;
-        Tree.Level2[i].RGB = i;
+/* 
+ * compress_photo
+ *   DESCRIPTION: Compress the pixel data of a room photo, row by row, and
+ *                release the uncompressed data.  Each row is coded on its
+ *                own as a series of literal strings and runs, so any row
+ *                can be decoded without the others (see photo_row):
+ *                    a byte c < 128 is followed by c + 1 literal pixels;
+ *                    a byte c >= 128 is followed by one pixel, repeated
+ *                    c - 125 times (3 to 130 times).
+ *                Rows never grow by more than one byte per 128 pixels.
+ *                If memory runs short, the photo is left uncompressed.
+ *   INPUTS: p -- the room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: replaces the photo's pixel data with compressed data
+ */
+static void
+compress_photo (photo_t* p)
+{
+    uint8_t*       rle;	     /* compressed pixel data               */
+    uint8_t*       out;	     /* next byte of compressed data        */
+    uint8_t*       tmp;	     /* reallocated buffer                  */
+    uint32_t*      row_start; /* offset of each compressed row      */
+    const uint8_t* row;	     /* current row of pixels               */
+    uint32_t       width;    /* photo width in pixels               */
+    uint32_t       x;	     /* index over pixels in row            */
+    uint32_t       lit;	     /* first pixel of pending literals     */
+    uint32_t       run;	     /* length of run starting at x         */
+    int32_t        y;	     /* index over rows                     */
+
+    width = p->hdr.width;
+    if (NULL == p->img || PHOTO_ROWS != p->layout || 
+        0 == width * p->hdr.height) {
+        return;
     }
 
-    // Initialize all level 4 nodes
-    for (i = 0; i < 4096; i++) {
-        Tree.Level4[i].count = 0;
-        Tree.Level4[i].Sum_R = 0;
-        Tree.Level4[i].Sum_G = 0;
-        Tree.Level4[i].Sum_B = 0;
-        Tree.Level4[i].RGB = i;
+    if (NULL == (rle = malloc (p->hdr.height * 
+    			       (width + (width + 127) / 128))) ||
+        NULL == (row_start = malloc ((p->hdr.height + 1) * 
+				     sizeof (row_start[0])))) {
+	if (NULL != rle) {
+	    free (rle);
+	}
+	return;
     }
+    out = rle;
+    for (y = 0, row = p->img; p->hdr.height > y; y++, row += width) {
+        row_start[y] = out - rle;
+	for (x = lit = 0; width > x; ) {
+	    for (run = 1; width > x + run && 130 > run && 
+	    		  row[x] == row[x + run]; run++) { }
+	    if (3 > run) {
+		/* Extend the literals, writing them out every 128 pixels. */
+	        if (128 == ++x - lit) {
+		    *out++ = 127;
+		    (void)memcpy (out, row + lit, 128);
+		    out += 128;
+		    lit = x;
+		}
+		continue;
+	    }
+	    if (lit < x) {
+	        *out++ = x - lit - 1;
+		(void)memcpy (out, row + lit, x - lit);
+		out += x - lit;
+	    }
+	    *out++ = run + 125;
+	    *out++ = row[x];
+	    lit = (x += run);
+	}
+	if (lit < x) {
+	    *out++ = x - lit - 1;
+	    (void)memcpy (out, row + lit, x - lit);
+	    out += x - lit;
+	}
+    }
+    row_start[y] = out - rle;
 
-    return Tree;
+    /* Shrink the buffer to fit, then drop the uncompressed data. */
+    if (NULL != (tmp = realloc (rle, out - rle))) {
+        rle = tmp;
+    }
+    release_img (p);
+    p->rle = rle;
+    p->row_start = row_start;
 }
 
 
-/*
-16-bit pixel format:   0bRRRRRGGGGGGBBBBB
-                       |   |      |     |
-                       |   |      |     Extract the 4-bit Blue component
-                       |   |      Extract the 4-bit Green component
-                       |   Extract the 4-bit Red component
-                       Left-shift Red by 4 bits
-                       Left-shift Green by 4 bits
-                       Right-shift Blue by 1 bit (to adjust for its position)
-
-12-bit output format:  0bRRRR-GGGG-BBBB
-*/
+/* 
+ * set_photo_layout
+ *   DESCRIPTION: Change the layout of a room photo's pixels in memory
+ *                (see photo_layout_t in photo.h).
+ *   INPUTS: p -- the room photo
+ *           layout -- the new layout
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if the layout is not valid, the
+ *                 photo is compressed or a panorama, or memory runs short
+ *   SIDE EFFECTS: replaces the photo's pixel data
+ */
+int32_t
+set_photo_layout (photo_t* p, photo_layout_t layout)
+{
+    uint8_t* img; /* pixel data in new layout */
 
-uint32_t convert16_to_12(uint16_t pixel) {
-    // Extract the 4 most significant bits of each color component
-    uint32_t Red = (pixel >> 12) & 0xF;  // Extract 4 bits for Red (RRRR)
-    uint32_t Green = (pixel >> 7) & 0xF; // Extract 4 bits for Green (GGGG)
-    uint32_t Blue = (pixel >> 1) & 0xF;  // Extract 4 bits for Blue (BBBB)
+    if (NUM_PHOTO_LAYOUTS <= (uint32_t)layout) {
+        return -1;
+    }
+    if (NULL == p->img) {
+        return (PHOTO_ROWS == layout ? 0 : -1);
+    }
+    if (layout == p->layout) {
+        return 0;
+    }
 
-    // Combine and pack the components into a 12-bit color
-    // Math explanation for combining:
-    // Red is shifted 8 bits to the left (RRRR0000)
-    // Green is shifted 4 bits to the left (0000GGGG)
-    // Blue is as-is (0000BBBB)
-    // Combining them using bitwise OR to get 12-bit format (RRRRGGGGBBBB)
-    uint32_t result = ((Red << 8) | (Green << 4) | Blue);
+    /* Moving into or out of tiles means copying all of the pixels. */
+    if (PHOTO_TILED == layout || PHOTO_TILED == p->layout) {
+        if (NULL == (img = retile_photo (p, PHOTO_TILED == layout))) {
+	    return -1;
+	}
+	release_img (p);
+	p->img = img;
+	p->img_on_heap = 1;
+    }
 
-    return result;
+    /* Any columns are built again if needed. */
+    if (NULL != p->cols) {
+        free (p->cols);
+	p->cols = NULL;
+    }
+    p->layout = layout;
+    return 0;
 }
 
-/*
-Input 12-bit pixel:  0bRRRRGGGGBBBB
-                      |  |     |    |
-                      |  |     |    Extract the 4-bit Blue component
-                      |  |     Extract the 4-bit Green component
-                      |  Extract the 4-bit Red component
-                      Left-shift Red by Red_6off bits
-                      Left-shift Green by Green_6off bits
-
-Output 6-bit value:   0bRRGGBB
-*/
 
-uint32_t convert12_to_6(uint16_t pixel) {
-    // Extract the 2 most significant bits of each color component
-    uint32_t Red = (pixel >> 10) & 0x3;  // Extract 2 bits for Red (RR)
-    uint32_t Green = (pixel >> 6) & 0x3; // Extract 2 bits for Green (GG)
-    uint32_t Blue = (pixel >> 2) & 0x3;  // Extract 2 bits for Blue (BB)
+/* 
+ * transpose_photo
+ *   DESCRIPTION: Build the columns of a PHOTO_DUAL room photo: a copy 
+ *                of the pixel data stored column by column, from the
+ *                left, with the top pixel of each column first.  The 
+ *                copy is made in square blocks so that both the rows 
+ *                read and the columns written stay in the cache.
+ *   INPUTS: p -- the room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if out of memory
+ *   SIDE EFFECTS: allocates and fills in the photo's columns
+ */
+static int
+transpose_photo (photo_t* p)
+{
+    uint32_t       w = p->hdr.width;  /* photo width in pixels     */
+    uint32_t       h = p->hdr.height; /* photo height in pixels    */
+    uint32_t       bx, by;	      /* upper left of block       */
+    uint32_t       x, y;	      /* pixel within photo        */
+    const uint8_t* row;		      /* current row of the photo  */
+
+    if (NULL == (p->cols = malloc (w * h))) {
+        return -1;
+    }
+    for (by = 0; h > by; by += PHOTO_TILE) {
+        for (bx = 0; w > bx; bx += PHOTO_TILE) {
+	    for (y = by; h > y && by + PHOTO_TILE > y; y++) {
+	        row = photo_row (p, y);
+		for (x = bx; w > x && bx + PHOTO_TILE > x; x++) {
+		    p->cols[h * x + y] = row[x];
+		}
+	    }
+	}
+    }
+    return 0;
+}
 
-    // Combine and pack the components into a 6-bit color
-    // Math explanation for combining:
-    // Red is shifted 4 bits to the left (RR00)
-    // Green is shifted 2 bits to the left (00GG)
-    // Blue is as-is (BB)
-    // Combining them using bitwise OR to get 6-bit format (RRGGBB)
-    uint32_t result = ((Red << 4) | (Green << 2) | Blue);
 
-    return result;
+/* 
+ * retile_photo
+ *   DESCRIPTION: Copy the pixels of an uncompressed room photo from the
+ *                PHOTO_ROWS (or PHOTO_DUAL) layout into PHOTO_TILED, or
+ *                back again.  Tiles along the right and bottom edges are
+ *                padded out to full size with black.
+ *   INPUTS: p -- the room photo
+ *           to_tiles -- 1 to go into tiles, or 0 to go into rows
+ *   OUTPUTS: none
+ *   RETURN VALUE: the newly allocated pixel data, or NULL if out of 
+ *                 memory
+ *   SIDE EFFECTS: none
+ */
+static uint8_t*
+retile_photo (const photo_t* p, int to_tiles)
+{
+    uint32_t w = p->hdr.width;  /* photo width in pixels     */
+    uint32_t h = p->hdr.height; /* photo height in pixels    */
+    uint8_t* img;		/* new pixel data            */
+    uint8_t* row;		/* current row (in rows)     */
+    uint8_t* tile;		/* current row (in tiles)    */
+    uint32_t x, y;		/* pixel within photo        */
+    uint32_t len;		/* pixels in one tile's row  */
+
+    if (to_tiles) {
+        img = calloc (TILES_ACROSS (p) * 
+		      ((h + PHOTO_TILE_MASK) >> PHOTO_TILE_SHIFT),
+		      PHOTO_TILE * PHOTO_TILE);
+    } else {
+        img = malloc (w * h);
+    }
+    if (NULL == img) {
+        return NULL;
+    }
+    for (y = 0; h > y; y++) {
+	for (x = 0; w > x; x += len) {
+	    len = PHOTO_TILE - (x & PHOTO_TILE_MASK);
+	    if (len > w - x) {
+	        len = w - x;
+	    }
+	    if (to_tiles) {
+	        row = p->img + w * y + x;
+		tile = img + TILED_OFFSET (p, x, y);
+		(void)memcpy (tile, row, len);
+	    } else {
+	        row = img + w * y + x;
+		tile = p->img + TILED_OFFSET (p, x, y);
+		(void)memcpy (row, tile, len);
+	    }
+	}
+    }
+    return img;
 }
 
-// Function to extract the Red component from a 16-bit RGB pixel
-uint32_t extractRed(uint16_t pixel) {
-    // Right-shift by the number of bits for Green and Blue (5 bits in total)
-    // to extract the 5-bit Red component, and then left-shift by 1 bit.
-    return ((pixel >> 11) & 0x1F) << 1;
-}
 
-// Function to extract the Green component from a 16-bit RGB pixel
-uint32_t extractGreen(uint16_t pixel) {
-    // Right-shift by the number of bits for Blue (5 bits) to extract the
-    // 5-bit Green component.
-    return ((pixel >> 5) & 0x3F);
-}
-
-// Function to extract the Blue component from a 16-bit RGB pixel
-uint32_t extractBlue(uint16_t pixel) {
-    // Mask the lowest 5 bits to extract the 5-bit Blue component.
-    return (pixel & 0x1F) << 1;
+/* 
+ * release_img
+ *   DESCRIPTION: Release a room photo's uncompressed pixel data: unmap
+ *                the precompiled file, free the heap copy, or (for a 
+ *                photo in the asset pack) simply forget it.
+ *   INPUTS: p -- the room photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets the photo's img to NULL
+ */
+static void
+release_img (photo_t* p)
+{
+    if (NULL != p->map) {
+        (void)munmap (p->map, p->map_len);
+	p->map = NULL;
+    } else if (p->img_on_heap) {
+        free (p->img);
+    }
+    p->img = NULL;
+    p->img_on_heap = 0;
 }
 
+
 /* 
-   Interface Description:
-   This function is used as a comparison function for sorting Octree_Node structures
-   in descending order based on their 'count' member. It is intended to be used with
-   the standard library function 'qsort' to sort an array of Octree_Node structures.
+ * index_obj_image
+ *   DESCRIPTION: Find the runs of opaque pixels in each row and column 
+ *                of an object image, and the box bounding its opaque 
+ *                pixels (see image_t), so that drawing can skip the 
+ *                transparent pixels and copy the opaque ones in runs.
+ *                A copy of the pixels column by column is made too.  
+ *                The index and the columns are allocated from the asset
+ *                arena (or from the heap if the arena is full).
+ *   INPUTS: im -- the object image, with its pixels filled in
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, or -1 if no memory is available
+ *   SIDE EFFECTS: fills in the image's span index, bounding box, and
+ *                 columns
+ */
+static int
+index_obj_image (image_t* im)
+{
+    const uint8_t* pix;	      /* pixels of the image                */
+    uint8_t*       cols;      /* pixels of the image by column      */
+    uint32_t       col_stride; /* padded length of image column     */
+    uint16_t*      row_span;  /* first span of each row             */
+    uint16_t*      col_span;  /* first span of each column          */
+    obj_span_t*    span;      /* the spans                          */
+    size_t         len;	      /* length of the index in bytes       */
+    int32_t        n_spans;   /* number of spans                    */
+    int32_t        x, y;      /* index over pixels                  */
+    int32_t        opaque;    /* pixel (x,y) is opaque              */
+    int32_t        was;	      /* previous pixel was opaque          */
+
+    /* Count the spans: each starts with an opaque pixel after a clear one. */
+    pix = im->img;
+    for (n_spans = 0, y = 0; im->hdr.height > y; y++) {
+        for (was = 0, x = 0; im->hdr.width > x; x++, was = opaque) {
+	    opaque = (OBJ_CLR_TRANSP != pix[im->stride * y + x]);
+	    n_spans += (opaque && !was);
+	}
+    }
+    for (x = 0; im->hdr.width > x; x++) {
+        for (was = 0, y = 0; im->hdr.height > y; y++, was = opaque) {
+	    opaque = (OBJ_CLR_TRANSP != pix[im->stride * y + x]);
+	    n_spans += (opaque && !was);
+	}
+    }
 
-   Parameters:
-   - a: Pointer to the first Octree_Node structure to compare.
-   - b: Pointer to the second Octree_Node structure to compare.
+    /* 
+     * Allocate the columns and the index (span starts for rows and 
+     * columns, then spans) together, and fill in the columns.
+     */
+    col_stride = (im->hdr.height + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    len = col_stride * im->hdr.width + 
+	  (im->hdr.height + im->hdr.width + 2) * sizeof (row_span[0]) +
+	  n_spans * sizeof (span[0]);
+    if (NULL == (cols = arena_alloc (len)) &&
+        0 != posix_memalign ((void**)&cols, ARENA_ALIGN, len)) {
+        return -1;
+    }
+    row_span = (uint16_t*)(cols + col_stride * im->hdr.width);
+    col_span = row_span + im->hdr.height + 1;
+    span = (obj_span_t*)(col_span + im->hdr.width + 1);
+    for (x = 0; im->hdr.width > x; x++) {
+        for (y = 0; im->hdr.height > y; y++) {
+	    cols[col_stride * x + y] = pix[im->stride * y + x];
+	}
+    }
 
-   Returns:
-   - A positive value if 'b->count' is greater than 'a->count'.
-   - A negative value if 'a->count' is greater than 'b->count'.
-   - 0 if 'a->count' is equal to 'b->count'.
-*/
+    /* Record the spans of each row, and the rows holding opaque pixels. */
+    im->box_left = im->hdr.width;
+    im->box_right = 0;
+    im->box_top = im->hdr.height;
+    im->box_bottom = 0;
+    for (n_spans = 0, y = 0; im->hdr.height > y; y++) {
+        row_span[y] = n_spans;
+        for (was = 0, x = 0; im->hdr.width > x; x++, was = opaque) {
+	    if ((opaque = (OBJ_CLR_TRANSP != pix[im->stride * y + x]))) {
+	        if (!was) {
+		    span[n_spans].start = x;
+		    span[n_spans++].len = 0;
+		}
+		span[n_spans - 1].len++;
+	    }
+	}
+	if (row_span[y] != n_spans) {
+	    if (im->box_top > y) {
+	        im->box_top = y;
+	    }
+	    im->box_bottom = y + 1;
+	}
+    }
+    row_span[y] = n_spans;
+
+    /* Likewise for each column. */
+    for (x = 0; im->hdr.width > x; x++) {
+        col_span[x] = n_spans;
+        for (was = 0, y = 0; im->hdr.height > y; y++, was = opaque) {
+	    if ((opaque = (OBJ_CLR_TRANSP != pix[im->stride * y + x]))) {
+	        if (!was) {
+		    span[n_spans].start = y;
+		    span[n_spans++].len = 0;
+		}
+		span[n_spans - 1].len++;
+	    }
+	}
+	if (col_span[x] != n_spans) {
+	    if (im->box_left > x) {
+	        im->box_left = x;
+	    }
+	    im->box_right = x + 1;
+	}
+    }
+    col_span[x] = n_spans;
 
-int compareFunction(const void *a, const void *b) {
-    // Cast 'a' and 'b' to Octree_Node pointers and compare their 'count' members
-    return (((Octree_Node*)b)->count - ((Octree_Node*)a)->count);
+    /* An image with no opaque pixels gets an empty box. */
+    if (im->box_left >= im->box_right) {
+        im->box_left = im->box_right = im->box_top = im->box_bottom = 0;
+    }
+    im->col_stride = col_stride;
+    im->cols = cols;
+    im->row_span = row_span;
+    im->col_span = col_span;
+    im->span = span;
+    return 0;
 }
-////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
@@ -46,15 +46,33 @@
 #include "types.h"
 #include "modex.h"
 #include "photo_headers.h"
+#include "quantize.h"
 #include "world.h"
 
 
 /* limits on allowed size of room photos and object images */
-#define MAX_PHOTO_WIDTH   1024
-#define MAX_PHOTO_HEIGHT  1024
+#define MAX_PHOTO_WIDTH   4096
+#define MAX_PHOTO_HEIGHT  4096
+#define PANO_MAX_WIDTH    16384		/* panoramas (see pano.h)   */
+#define PANO_MAX_HEIGHT   4096
 #define MAX_OBJECT_WIDTH  160
 #define MAX_OBJECT_HEIGHT 100
 
+/* 
+ * Layouts for the pixels of a room photo in memory.  PHOTO_ROWS is the
+ * usual row-by-row layout.  PHOTO_TILED stores 32x32 tiles (row by row
+ * of tiles, and row by row within each tile), so that vertical lines 
+ * read only a few bytes per cache line.  PHOTO_DUAL keeps the rows and
+ * adds a transposed (column by column) copy, built the first time a
+ * vertical line is drawn, at the cost of twice the memory.
+ */
+typedef enum {
+    PHOTO_ROWS,
+    PHOTO_TILED,
+    PHOTO_DUAL,
+    NUM_PHOTO_LAYOUTS
+} photo_layout_t;
+
 
 /* Fill a buffer with the pixels for a horizontal line of current room. */
 extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
@@ -86,21 +104,58 @@ extern image_t* read_obj_image (const char* fname);
 /* Read room photo from a file into a dynamically allocated structure. */
 extern photo_t* read_photo (const char* fname);
 
-//////////////////////////////////////////////////////////////////////// my inits  /////////////////////////////////////////////////////////////////////
-struct Octree create_Octree();
-uint32_t convert16_to_12(uint16_t pixel);
-uint32_t convert12_to_6(uint16_t pixel);
-uint32_t extractRed(uint16_t pixel);
-uint32_t extractGreen(uint16_t pixel);
-uint32_t extractBlue(uint16_t pixel);
-int compareFunction(const void *a, const void *b);
-//////////////////////////////////////////////////////////////////////// my inits /////////////////////////////////////////////////////////////////////
 /* 
- * N.B.  I'm aware that Valgrind and similar tools will report the fact that
- * I chose not to bother freeing image data before terminating the program.
- * It's probably a bad habit, but ... maybe in a future release (FIXME).
- * (The data are needed until the program terminates, and all data are freed
- * when a program terminates.)
+ * Find the size of the photo in a file without reading the photo; 
+ * returns 0 on success, or -1 on failure.
+ */
+extern int32_t read_photo_header (const char* fname, photo_header_t* hdr);
+
+/* Find the number of bytes of memory used by a room photo. */
+extern size_t photo_memory (const photo_t* p);
+
+/* Free a room photo (from the thread that draws photos). */
+extern void free_photo (photo_t* p);
+
+/* Free a room photo that has never been drawn (from any thread). */
+extern void free_unshown_photo (photo_t* p);
+
+/* 
+ * Find the directory holding cached photos (creating it if need be);
+ * returns NULL if the cache is turned off.  The directory is named by
+ * the ADVENTURE_PHOTO_CACHE environment variable, or is .photo_cache.
+ */
+extern const char* photo_cache_dir (void);
+
+/* Read and quantize a photo with a specific quantizer (see quantize.h). */
+extern photo_t* read_photo_with_quantizer (const char* fname, 
+					   quantizer_t q);
+
+/* 
+ * Save a room photo or object image to a file, and restore it from 
+ * saved data that stay mapped until the program ends (the pixels are
+ * used in place).  The saves return 0 on success, or -1 on failure;
+ * the restores return NULL if the data are damaged.  Panoramas cannot
+ * be saved.
+ */
+extern int32_t save_photo (FILE* out, const photo_t* p);
+extern photo_t* restore_photo (const void* data, size_t len);
+extern int32_t save_obj_image (FILE* out, const image_t* im);
+extern image_t* restore_obj_image (const void* data, size_t len);
+
+/* 
+ * Change the layout of a room photo's pixels in memory; returns 0 on 
+ * success, or -1 on failure (the photo is then unchanged).  Photos are
+ * read in the layout named by the ADVENTURE_PHOTO_LAYOUT environment
+ * variable ("rows", "tiled", or "dual"), or PHOTO_ROWS by default.
+ * Compressed photos always use PHOTO_ROWS.
+ */
+extern int32_t set_photo_layout (photo_t* p, photo_layout_t layout);
+
+/* 
+ * N.B.  Object images are needed until the program terminates, so they
+ * are allocated from the asset arena (see arena.h) and released with it 
+ * in one shot at shutdown rather than freed one by one.  Room photos 
+ * may be freed with free_photo.
  */
 
 #endif /* PHOTO_H */
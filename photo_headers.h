@@ -81,5 +81,70 @@ struct photo_header_t {
     uint16_t height;	/* image height in pixels */
 };
 
+/*
+ * Precompiled room photo file header.  Produced offline by photoc from
+ * a room photo, a precompiled photo holds the 192 palette colors and
+ * the one-byte palette indices chosen by a quantizer, so the game need
+ * only map the file.  The index plane starts at data_offset (a multiple
+ * of QPHOTO_ALIGN, so it can be mapped directly) and is stored in 
+ * memory order: from the upper left, top row first, with no padding.
+ *
+ * The first two bytes of the magic read as a width of 0x5051, larger
+ * than any room photo, so the two formats cannot be confused.  The 
+ * size, modification time (to the nanosecond; see QPHOTO_MTIME), and 
+ * hash of the source photo are recorded so that a stale precompiled 
+ * photo can be recognized (and ignored), and the hash of the index 
+ * plane so that a damaged one can be.  The hashes are computed with 
+ * photo_source_hash and photo_hash (see quantize.h).
+ */
+#define QPHOTO_MAGIC   "QPH1"	/* precompiled photo magic sequence     */
+#define QPHOTO_SUFFIX  ".qphoto" /* replaces ".photo" in source name    */
+#define QPHOTO_ALIGN   4096	/* alignment of index plane in file     */
+
+/* modification time of a source photo's struct stat as recorded */
+#define QPHOTO_MTIME(st)                                                 \
+    ((int64_t)(st)->st_mtim.tv_sec * 1000000000 + (st)->st_mtim.tv_nsec)
+
+typedef struct qphoto_header_t qphoto_header_t;
+struct qphoto_header_t {
+    char     magic[4];		/* QPHOTO_MAGIC (not NUL-terminated)     */
+    uint16_t width;		/* image width in pixels                 */
+    uint16_t height;		/* image height in pixels                */
+    uint16_t quantizer;		/* quantizer used (a quantizer_t)        */
+    uint16_t version;		/* QUANTIZER_VERSION when built          */
+    uint32_t data_offset;	/* file offset of index plane            */
+    uint64_t src_size;		/* size of source photo file in bytes    */
+    int64_t  src_mtime;		/* QPHOTO_MTIME of source photo           */
+    uint64_t src_hash;		/* hash of source photo file contents    */
+    uint64_t data_sum;		/* hash of index plane                   */
+    uint8_t  palette[192][3];	/* palette colors (6 bits per channel)   */
+};
+
+/*
+ * Panorama file header.  A panorama is a room photo too large to keep
+ * in memory (up to PANO_MAX_WIDTH by PANO_MAX_HEIGHT; see photo.h), 
+ * quantized offline (by photoc -t) with a single palette and cut into
+ * square tiles of (1 << tile_shift) pixels on a side, which the game
+ * reads from the file as they come into view (see pano.c).  The tiles
+ * start at data_offset (a multiple of QPHOTO_ALIGN) and are stored 
+ * row by row of tiles, from the upper left, each tile holding its 
+ * pixels row by row.  Tiles along the right and bottom edges are 
+ * padded out to full size with zeroes.
+ */
+#define QPAN_MAGIC      "QPN1"	/* panorama magic sequence           */
+#define QPAN_SUFFIX     ".qpan"	/* suffix of panorama file names     */
+#define QPAN_TILE_SHIFT 6	/* tiles are 64x64 (one 4kB page)    */
+
+typedef struct qpan_header_t qpan_header_t;
+struct qpan_header_t {
+    char     magic[4];		/* QPAN_MAGIC (not NUL-terminated)       */
+    uint16_t width;		/* image width in pixels                 */
+    uint16_t height;		/* image height in pixels                */
+    uint16_t tile_shift;	/* log2 of tile width (QPAN_TILE_SHIFT)  */
+    uint16_t quantizer;		/* quantizer used (a quantizer_t)        */
+    uint32_t data_offset;	/* file offset of first tile             */
+    uint8_t  palette[192][3];	/* palette colors (6 bits per channel)   */
+};
+
 #endif /* PHOTO_HEADERS_H */
 
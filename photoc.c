@@ -0,0 +1,253 @@
+/*									tab:8
+ *
+ * photoc.c - utility program for precompiling adventure game room photos
+ *
+ * This file is a standalone utility program that quantizes room photos
+ * ahead of time.  Each room photo (5:6:5 RGB, as written by mp2photo)
+ * is run through a quantizer, and the resulting palette and one-byte 
+ * pixels are written out as a precompiled photo (see qphoto_header_t in
+ * photo_headers.h).  By default, the output for "name.photo" goes to 
+ * "name.qphoto", where read_photo looks for it.  "make qphotos" builds
+ * precompiled photos for all of the game's photos.
+ *
+ * With -t, the photo may be as large as a panorama, and is written
+ * instead as a panorama file cut into tiles (see qpan_header_t), by 
+ * default to "name.qpan".  The game streams the tiles of a panorama
+ * from the file as they come into view rather than holding it all.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "photo_headers.h"
+#include "quantize.h"
+
+
+/* largest photo accepted; matches MAX_PHOTO_WIDTH/HEIGHT in photo.h */
+#define MAX_PHOTOC_DIM 4096
+
+/* largest panorama accepted; matches PANO_MAX_WIDTH/HEIGHT in photo.h */
+#define MAX_PANO_WIDTH  16384
+#define MAX_PANO_HEIGHT 4096
+
+
+// Reads a photo file no larger than max_width by max_height into a newly
+// allocated buffer of 5:6:5 pixels, and records the file's size and 
+// modification time in the output header.  Returns the buffer on 
+// success, or NULL (after complaining) on failure.
+static uint16_t*
+read_source (const char* fname, int32_t max_width, int32_t max_height,
+	     photo_header_t* hdr, qphoto_header_t* qh)
+{
+    FILE*       in;
+    struct stat st;
+    uint16_t*   pixels;
+    size_t      n_pixels;
+
+    if (NULL == (in = fopen (fname, "r+b")) || 0 != fstat (fileno (in), &st)) {
+        perror (fname);
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return NULL;
+    }
+    if (1 != fread (hdr, sizeof (*hdr), 1, in) ||
+        max_width < hdr->width || max_height < hdr->height) {
+        fprintf (stderr, "%s: bad photo header\n", fname);
+	(void)fclose (in);
+	return NULL;
+    }
+    n_pixels = (size_t)hdr->width * hdr->height;
+    if (NULL == (pixels = malloc (n_pixels * sizeof (pixels[0]))) ||
+        n_pixels != fread (pixels, sizeof (pixels[0]), n_pixels, in)) {
+        fprintf (stderr, "%s: short photo\n", fname);
+	free (pixels);
+	(void)fclose (in);
+	return NULL;
+    }
+    (void)fclose (in);
+    qh->src_size = st.st_size;
+    qh->src_mtime = QPHOTO_MTIME (&st);
+    qh->src_hash = photo_source_hash (hdr, pixels);
+    return pixels;
+}
+
+// Writes a precompiled photo: the header, padding up to the index
+// plane, and the index plane.  Returns 1 on success, or 0 on failure.
+static int
+write_qphoto (const char* fname, const qphoto_header_t* qh, 
+	      const uint8_t* img)
+{
+    static const uint8_t zeros[QPHOTO_ALIGN]; 
+    FILE*                out;
+    int                  written;
+
+    if (NULL == (out = fopen (fname, "w+b"))) {
+        perror (fname);
+	return 0;
+    }
+    written = (1 == fwrite (qh, sizeof (*qh), 1, out) &&
+	       1 == fwrite (zeros, qh->data_offset - sizeof (*qh), 1, out) &&
+	       ((size_t)qh->width * qh->height ==
+	        fwrite (img, 1, (size_t)qh->width * qh->height, out)));
+    if (EOF == fclose (out)) {
+	written = 0;
+    }
+    if (!written) {
+	perror (fname);
+	(void)remove (fname);
+    }
+    return written;
+}
+
+// Writes a panorama: the header, padding up to the first tile, and the
+// tiles, cut from the quantized photo.  Returns 1 on success, or 0 on 
+// failure.
+static int
+write_qpan (const char* fname, const qpan_header_t* qh, const uint8_t* img)
+{
+    static const uint8_t zeros[QPHOTO_ALIGN]; 
+    uint8_t              tile[1 << (2 * QPAN_TILE_SHIFT)];
+    FILE*                out;
+    int                  written;
+    int32_t              size, tx, ty, y, len;
+
+    if (NULL == (out = fopen (fname, "w+b"))) {
+        perror (fname);
+	return 0;
+    }
+    written = (1 == fwrite (qh, sizeof (*qh), 1, out) &&
+	       1 == fwrite (zeros, qh->data_offset - sizeof (*qh), 1, out));
+    size = (1 << QPAN_TILE_SHIFT);
+    for (ty = 0; written && qh->height > ty; ty += size) {
+        for (tx = 0; written && qh->width > tx; tx += size) {
+	    // Copy the tile out of the photo, padding it with zeroes.
+	    (void)memset (tile, 0, sizeof (tile));
+	    len = (qh->width - tx < size ? qh->width - tx : size);
+	    for (y = 0; size > y && qh->height > ty + y; y++) {
+	        (void)memcpy (tile + y * size, 
+			      img + (size_t)(ty + y) * qh->width + tx, len);
+	    }
+	    written = (1 == fwrite (tile, sizeof (tile), 1, out));
+	}
+    }
+    if (EOF == fclose (out)) {
+	written = 0;
+    }
+    if (!written) {
+	perror (fname);
+	(void)remove (fname);
+    }
+    return written;
+}
+
+int
+main (int argc, char* argv[])
+{
+    qphoto_header_t qh;
+    qpan_header_t   pan;
+    photo_header_t  hdr;
+    uint16_t*       pixels;
+    uint8_t*        img;
+    quantizer_t     q;
+    int32_t         first_arg;
+    int32_t         tiled;
+    char            out_name[1024];
+    const char*     out;
+    const char*     suffix;
+    size_t          len;
+    int32_t         written;
+
+    // Check syntax of invocation.
+    q = default_quantizer ();
+    tiled = 0;
+    for (first_arg = 1; argc > first_arg; ) {
+	if (0 == strcmp (argv[first_arg], "-t")) {
+	    tiled = 1;
+	    first_arg++;
+	} else if (argc > first_arg + 1 && 
+		   0 == strcmp (argv[first_arg], "-e")) {
+	    if (NUM_QUANTIZERS == 
+	        (q = quantizer_by_name (argv[first_arg + 1]))) {
+		fprintf (stderr, "%s: unknown quantizer %s\n", argv[0], 
+			 argv[first_arg + 1]);
+		return 2;
+	    }
+	    first_arg += 2;
+	} else {
+	    break;
+	}
+    }
+    if (argc != first_arg + 1 && argc != first_arg + 2) {
+    	fprintf (stderr, "usage: %s [-t] [-e <engine>] <photo file> "
+		 "[<output file>]\n", argv[0]);
+	return 2;
+    }
+
+    // Pick the output file name: name.photo becomes name.qphoto (or,
+    // with -t, name.qpan).
+    suffix = (tiled ? QPAN_SUFFIX : QPHOTO_SUFFIX);
+    if (argc == first_arg + 2) {
+        out = argv[first_arg + 1];
+    } else {
+	len = strlen (argv[first_arg]);
+	if (6 <= len && 0 == strcmp (argv[first_arg] + len - 6, ".photo")) {
+	    len -= 6;
+	}
+	if (len + strlen (suffix) + 1 > sizeof (out_name)) {
+	    fprintf (stderr, "%s: file name too long\n", argv[0]);
+	    return 2;
+	}
+	(void)memcpy (out_name, argv[first_arg], len);
+	(void)strcpy (out_name + len, suffix);
+	out = out_name;
+    }
+
+    // Read and quantize the photo.
+    (void)memset (&qh, 0, sizeof (qh));
+    if (NULL == (pixels = read_source (argv[first_arg], 
+    				       tiled ? MAX_PANO_WIDTH : MAX_PHOTOC_DIM,
+				       tiled ? MAX_PANO_HEIGHT : MAX_PHOTOC_DIM,
+				       &hdr, &qh))) {
+        return 2;
+    }
+    if (NULL == (img = malloc ((size_t)hdr.width * hdr.height)) ||
+        0 != quantize_photo (q, &hdr, pixels, qh.palette, img)) {
+        fprintf (stderr, "%s: out of memory\n", argv[0]);
+	return 3;
+    }
+    free (pixels);
+
+    // A panorama has a header of its own.
+    if (tiled) {
+	(void)memset (&pan, 0, sizeof (pan));
+	(void)memcpy (pan.magic, QPAN_MAGIC, sizeof (pan.magic));
+	pan.width = hdr.width;
+	pan.height = hdr.height;
+	pan.tile_shift = QPAN_TILE_SHIFT;
+	pan.quantizer = q;
+	pan.data_offset = 
+	    (sizeof (pan) + QPHOTO_ALIGN - 1) & ~(QPHOTO_ALIGN - 1);
+	(void)memcpy (pan.palette, qh.palette, sizeof (pan.palette));
+	written = write_qpan (out, &pan, img);
+	free (img);
+	return (written ? 0 : 3);
+    }
+
+    // Fill in the rest of the header, then write the file.
+    (void)memcpy (qh.magic, QPHOTO_MAGIC, sizeof (qh.magic));
+    qh.width = hdr.width;
+    qh.height = hdr.height;
+    qh.quantizer = q;
+    qh.version = QUANTIZER_VERSION;
+    qh.data_offset = (sizeof (qh) + QPHOTO_ALIGN - 1) & ~(QPHOTO_ALIGN - 1);
+    qh.data_sum = photo_hash (img, (size_t)hdr.width * hdr.height);
+    written = write_qphoto (out, &qh, img);
+    free (img);
+
+    return (written ? 0 : 3);
+}
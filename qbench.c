@@ -0,0 +1,195 @@
+/*									tab:8
+ *
+ * qbench.c - benchmark for the room photo quantizers
+ *
+ * This file is a standalone utility program that runs each quantizer
+ * (or just one, given with -e) over a set of room photos and reports,
+ * for each photo and engine, the time taken, the mean squared error of
+ * the quantized photo (per channel, in the 6-bit palette units), and
+ * the number of palette colors actually used.  Totals for each engine
+ * follow.  "make bench" runs it over all of the game's photos.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "photo_headers.h"
+#include "quantize.h"
+
+
+/* largest photo accepted; matches MAX_PHOTO_WIDTH/HEIGHT in photo.h */
+#define MAX_BENCH_DIM 4096
+
+
+/* per-engine totals over all photos */
+typedef struct {
+    double   seconds;	/* time spent quantizing         */
+    double   sq_error;	/* sum of squared channel errors */
+    uint64_t samples;	/* number of channels compared   */
+} bench_total_t;
+
+
+/*
+ * Get the time on the monotonic clock in seconds.
+ */
+static double
+now ()
+{
+    struct timespec ts;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Reads a photo file into a newly allocated buffer of 5:6:5 pixels.
+// Returns the buffer on success, or NULL (after complaining) on failure.
+static uint16_t*
+read_source (const char* fname, photo_header_t* hdr)
+{
+    FILE*     in;
+    uint16_t* pixels;
+    size_t    n_pixels;
+
+    if (NULL == (in = fopen (fname, "r+b"))) {
+        perror (fname);
+	return NULL;
+    }
+    if (1 != fread (hdr, sizeof (*hdr), 1, in) ||
+        MAX_BENCH_DIM < hdr->width || MAX_BENCH_DIM < hdr->height) {
+        fprintf (stderr, "%s: bad photo header\n", fname);
+	(void)fclose (in);
+	return NULL;
+    }
+    n_pixels = (size_t)hdr->width * hdr->height;
+    if (NULL == (pixels = malloc (n_pixels * sizeof (pixels[0]))) ||
+        n_pixels != fread (pixels, sizeof (pixels[0]), n_pixels, in)) {
+        fprintf (stderr, "%s: short photo\n", fname);
+	free (pixels);
+	(void)fclose (in);
+	return NULL;
+    }
+    (void)fclose (in);
+    return pixels;
+}
+
+// Adds up the squared error of a quantized photo against its source
+// (in 6-bit channel units) and counts the palette colors it uses.
+static double
+measure_error (const photo_header_t* hdr, const uint16_t* pixels,
+	       uint8_t palette[192][3], const uint8_t* img,
+	       int32_t* colors_used)
+{
+    uint8_t  used[192];
+    double   sq_error;
+    int32_t  x, y, d, i;
+    uint16_t px;
+    uint8_t  c;
+
+    (void)memset (used, 0, sizeof (used));
+    sq_error = 0;
+    for (y = 0; hdr->height > y; y++) {
+	// The file stores rows from bottom to top; the photo from top down.
+        for (x = 0; hdr->width > x; x++) {
+	    px = pixels[y * hdr->width + x];
+	    c = img[(hdr->height - 1 - y) * hdr->width + x] - 64;
+	    used[c] = 1;
+	    d = ((px >> 10) & 0x3E) - palette[c][0];
+	    sq_error += d * d;
+	    d = ((px >> 5) & 0x3F) - palette[c][1];
+	    sq_error += d * d;
+	    d = ((px << 1) & 0x3E) - palette[c][2];
+	    sq_error += d * d;
+	}
+    }
+    for (i = 0, *colors_used = 0; 192 > i; i++) {
+        *colors_used += used[i];
+    }
+    return sq_error;
+}
+
+int
+main (int argc, char* argv[])
+{
+    bench_total_t  total[NUM_QUANTIZERS];
+    photo_header_t hdr;
+    uint16_t*      pixels;
+    uint8_t        palette[192][3];
+    uint8_t*       img;
+    quantizer_t    only;
+    quantizer_t    q;
+    int32_t        first_file;
+    int32_t        colors_used;
+    double         start;
+    double         seconds;
+    double         sq_error;
+    uint64_t       samples;
+    int32_t        i;
+
+    // Check syntax of invocation.
+    only = NUM_QUANTIZERS;
+    first_file = 1;
+    if (3 <= argc && 0 == strcmp (argv[1], "-e")) {
+        if (NUM_QUANTIZERS == (only = quantizer_by_name (argv[2]))) {
+	    fprintf (stderr, "%s: unknown quantizer %s\n", argv[0], argv[2]);
+	    return 2;
+	}
+	first_file = 3;
+    }
+    if (argc <= first_file) {
+    	fprintf (stderr, "usage: %s [-e <engine>] <photo file> ...\n",
+		 argv[0]);
+	return 2;
+    }
+
+    (void)memset (total, 0, sizeof (total));
+    printf ("%-28s %-10s %10s %10s %6s\n",
+	    "photo", "engine", "ms", "MSE", "colors");
+    for (i = first_file; argc > i; i++) {
+	if (NULL == (pixels = read_source (argv[i], &hdr))) {
+	    return 3;
+	}
+	if (NULL == (img = malloc ((size_t)hdr.width * hdr.height))) {
+	    perror ("malloc");
+	    return 3;
+	}
+	samples = 3 * (uint64_t)hdr.width * hdr.height;
+        for (q = 0; NUM_QUANTIZERS > q; q++) {
+	    if (NUM_QUANTIZERS != only && only != q) {
+	        continue;
+	    }
+	    start = now ();
+	    if (0 != quantize_photo (q, &hdr, pixels, palette, img)) {
+	        fprintf (stderr, "%s: out of memory\n", argv[i]);
+		return 3;
+	    }
+	    seconds = now () - start;
+	    sq_error = measure_error (&hdr, pixels, palette, img,
+	    			      &colors_used);
+	    printf ("%-28s %-10s %10.2f %10.3f %6d\n", argv[i],
+		    quantizer_name (q), seconds * 1000,
+		    0 == samples ? 0.0 : sq_error / samples, colors_used);
+	    total[q].seconds += seconds;
+	    total[q].sq_error += sq_error;
+	    total[q].samples += samples;
+	}
+	free (img);
+	free (pixels);
+    }
+
+    // Print the totals for each engine.
+    printf ("\n");
+    for (q = 0; NUM_QUANTIZERS > q; q++) {
+	if (NUM_QUANTIZERS != only && only != q) {
+	    continue;
+	}
+	printf ("%-28s %-10s %10.2f %10.3f\n", "(all photos)",
+		quantizer_name (q), total[q].seconds * 1000,
+		0 == total[q].samples ? 0.0 :
+		total[q].sq_error / total[q].samples);
+    }
+    return 0;
+}
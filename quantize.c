@@ -0,0 +1,1122 @@
+/*									tab:8
+ *
+ * quantize.c - room photo color quantization
+ *
+ * Room photos are stored as 5:6:5 RGB, but the VGA shows them through a
+ * palette: the 64 colors 0-63 are fixed (2:2:2 RGB, used by objects and
+ * the status bar), leaving colors 64-255 to be chosen for each photo.
+ *
+ * Every quantizer starts the same way: one pass counts the pixels of 
+ * each 5:6:5 color, and the counts are folded into the 4096 level-four
+ * octree nodes (4 bits per channel).  The quantizer then picks the 192
+ * palette colors from the nodes and fills in a table giving the palette
+ * color for each node, and a second pass maps every pixel through that
+ * table.  The quantizers are
+ *
+ *   octree    -- the 128 most popular level-four nodes, plus the 64
+ *                level-two nodes holding whatever is left (the default)
+ *   mediancut -- repeatedly splits the box of node colors with the most
+ *                pixels times the widest extent at its weighted median
+ *   kmeans    -- the octree palette, improved by a few k-means passes
+ *                that move each color to the mean of the nodes nearest
+ *                to it
+ *
+ * Use "make bench" to compare their speed and quality on the photos.
+ */
+
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "quantize.h"
+
+
+/* parameters defined for this file */
+
+/* 
+ * Photos with at least QUANTIZE_PARALLEL_PIXELS pixels are quantized by
+ * several threads, each handling a band of rows; for smaller photos the
+ * threads cost more than they save.  At most QUANTIZE_MAX_THREADS threads
+ * (including the caller) work on one photo.
+ */
+#if !defined(QUANTIZE_PARALLEL_PIXELS)
+#define QUANTIZE_PARALLEL_PIXELS (512 * 512)
+#endif
+#if !defined(QUANTIZE_MAX_THREADS)
+#define QUANTIZE_MAX_THREADS 8
+#endif
+
+/* number of k-means passes made by the kmeans quantizer */
+#define KMEANS_PASSES 3
+
+/* 
+ * Name of the environment variable that can be used to pick the default
+ * quantizer by name (for example, ADVENTURE_QUANTIZER=mediancut).
+ */
+#define QUANTIZER_ENV "ADVENTURE_QUANTIZER"
+
+
+/* types local to this file */
+
+////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
+/*Interface Description:
+The Octree structure represents a tree data structure used for color quantization or similar purposes.
+It consists of two levels: Level2 and Level4, with Level2 containing 64 nodes and Level4 containing 4096 nodes.
+Each node in the Octree_Node structure stores color information (RGB), sums of color components (Sum_R, Sum_G, Sum_B), 
+a count of the number of colors represented by the node (count).
+The tree also carries the scratch space used while quantizing one photo: a histogram over all 65536 5:6:5 colors,
+the non-empty level 4 nodes being ranked, and the lookup table from level 4 node to palette index.*/
+
+// Define the structure for a node in the Octree
+typedef struct Octree_Node {
+    uint32_t RGB;
+    uint32_t Sum_R;
+    uint32_t Sum_G;
+    uint32_t Sum_B;
+    uint32_t count;
+} Octree_Node;
+
+// Define the Octree structure
+typedef struct Octree {
+    Octree_Node Level2[64];    // Array of nodes at level 2 (8^2 = 64 nodes)
+    Octree_Node Level4[4096];  // Array of nodes at level 4 (8^4 = 4096 nodes)
+    Octree_Node Ranked[4096];  // Non-empty level 4 nodes, most popular 128 first
+    uint8_t     Lookup[4096];  // VGA palette index for each level 4 node
+    uint32_t    Histogram[65536]; // Pixel count for each 5:6:5 color
+} Octree;
+////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
+
+/* 
+ * One band of rows of a photo being quantized.  Each quantization pass
+ * runs over the bands in parallel (see run_quantize_bands); the bands
+ * share the photo and the octree, and only write to their own rows and
+ * to their own histogram.
+ */
+typedef struct quantize_band_t quantize_band_t;
+struct quantize_band_t {
+    const photo_header_t* hdr;	/* dimensions of the photo            */
+    uint8_t*        img;	/* pixel data being produced          */
+    const Octree*   tree;	/* octree, with Lookup filled in      */
+    const uint16_t* pixels;	/* first source pixel of the band     */
+    uint16_t        first_row;	/* first row of band (in file order)  */
+    uint16_t        num_rows;	/* number of rows in the band         */
+    uint32_t*       histogram;	/* color counts for the band's pixels */
+};
+
+/* 
+ * A box of level-four nodes for the median cut quantizer: a range of 
+ * the Ranked array, along with the number of pixels in it and the 
+ * channel (axis) with the widest extent of node colors.
+ */
+typedef struct mcut_box_t mcut_box_t;
+struct mcut_box_t {
+    int32_t  first;	/* index of first node in Ranked     */
+    int32_t  num_nodes;	/* number of nodes in the box         */
+    uint32_t pixels;	/* number of pixels in the box        */
+    int32_t  axis;	/* widest channel (0=R, 1=G, 2=B)     */
+    int32_t  extent;	/* extent of node colors on that axis */
+};
+
+/* A quantizer: its name and its palette selection function. */
+typedef struct quantizer_engine_t quantizer_engine_t;
+struct quantizer_engine_t {
+    const char* name;
+    void (*select_palette) (struct Octree* tree, uint8_t palette[192][3]);
+};
+
+
+/* local functions--see function headers for details */
+static int32_t quantize_thread_count (const photo_header_t* hdr);
+static void run_quantize_bands (void* (*fn) (void*), quantize_band_t* band, 
+				int32_t num_bands);
+static void* count_band (void* arg);
+static void* remap_band (void* arg);
+static void median_cut_palette (Octree* tree, uint8_t palette[192][3]);
+static void measure_box (const Octree* tree, mcut_box_t* box);
+static int compare_red (const void* a, const void* b);
+static int compare_green (const void* a, const void* b);
+static int compare_blue (const void* a, const void* b);
+static void kmeans_palette (Octree* tree, uint8_t palette[192][3]);
+static void init_default_quantizer ();
+
+
+/* file-scope variables */
+
+/* the quantizers, indexed by quantizer_t */
+static const quantizer_engine_t engine[NUM_QUANTIZERS] = {
+    {"octree",    build_palette},
+    {"mediancut", median_cut_palette},
+    {"kmeans",    kmeans_palette}
+};
+
+/* 
+ * The quantizer used when none is given for a photo.  It is read from
+ * the environment the first time it is needed (see init_default_quantizer).
+ */
+static quantizer_t     default_q = QUANT_OCTREE;
+static pthread_once_t  default_q_once = PTHREAD_ONCE_INIT;
+
+
+/* 
+ * quantize_photo
+ *   DESCRIPTION: Choose the 192 palette colors for a photo and map its
+ *                pixels into them.  The first pass builds a histogram of
+ *                the 5:6:5 colors, which is folded into the level-four 
+ *                octree nodes.  The quantizer then picks the palette and
+ *                fills in the palette color for each node, and the second
+ *                pass maps every pixel through that lookup table.
+ *
+ *                Large photos are split into bands of rows, and both
+ *                passes run over the bands in parallel.  Each band counts
+ *                into a private histogram, and the histograms are summed
+ *                before the palette is chosen, so the result is the same
+ *                no matter how many threads are used.
+ *   INPUTS: q -- the quantizer to use
+ *           hdr -- dimensions of the photo
+ *           pixels -- 5:6:5 RGB pixels in file order (lower left first,
+ *                     rows from bottom to top)
+ *   OUTPUTS: palette -- the 192 palette colors (6 bits per channel)
+ *            img -- one-byte pixels, stored from the upper left
+ *   RETURN VALUE: 0 on success, or -1 if out of memory
+ *   SIDE EFFECTS: none
+ */
+int32_t
+quantize_photo (quantizer_t q, const photo_header_t* hdr, 
+		const uint16_t* pixels, uint8_t palette[192][3], uint8_t* img)
+{
+    quantize_band_t band[QUANTIZE_MAX_THREADS]; /* bands of rows     */
+    Octree*         tree;		/* octree and scratch space  */
+    int32_t         num_bands;		/* number of bands used      */
+    int32_t         idx;		/* index over bands          */
+    uint32_t        row;		/* first row of next band    */
+    uint32_t        color;		/* index over histogram      */
+
+    if (NUM_QUANTIZERS <= (uint32_t)q) {
+        q = default_quantizer ();
+    }
+    if (NULL == (tree = malloc (sizeof (*tree)))) {
+        return -1;
+    }
+    init_Octree (tree);
+
+    /* 
+     * Split the rows into bands as evenly as possible.  The first band
+     * counts straight into the octree's histogram; the others need 
+     * their own (fixed-size) histograms.  If we can't get the memory,
+     * we just use fewer bands.
+     */
+    num_bands = quantize_thread_count (hdr);
+    for (idx = 1; num_bands > idx; idx++) {
+        if (NULL == (band[idx].histogram = 
+		     calloc (65536, sizeof (band[idx].histogram[0])))) {
+	    break;
+	}
+    }
+    num_bands = idx;
+    band[0].histogram = tree->Histogram;
+    for (idx = 0, row = 0; num_bands > idx; idx++) {
+        band[idx].hdr = hdr;
+        band[idx].img = img;
+        band[idx].tree = tree;
+	band[idx].first_row = row;
+	band[idx].num_rows = (hdr->height - row) / (num_bands - idx);
+	band[idx].pixels = pixels + row * hdr->width;
+	row += band[idx].num_rows;
+    }
+
+    /* First pass: count the pixels of each 5:6:5 color. */
+    run_quantize_bands (count_band, band, num_bands);
+    for (idx = 1; num_bands > idx; idx++) {
+        for (color = 0; 65536 > color; color++) {
+	    tree->Histogram[color] += band[idx].histogram[color];
+	}
+	free (band[idx].histogram);
+    }
+
+    /* 
+     * The level four nodes are filled in from the histogram, which 
+     * costs the same for any photo size.  Then pick the palette colors
+     * and fill in the lookup table.
+     */
+    fill_Level4 (tree);
+    (*engine[q].select_palette) (tree, palette);
+
+    /* Second pass: map every pixel through the lookup table. */
+    run_quantize_bands (remap_band, band, num_bands);
+
+    free (tree);
+    return 0;
+}
+
+
+/* 
+ * quantize_thread_count
+ *   DESCRIPTION: Decide how many threads should quantize a photo.
+ *   INPUTS: hdr -- dimensions of the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of threads (and bands of rows), at least 1
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quantize_thread_count (const photo_header_t* hdr)
+{
+    long num_cpus; /* number of processors online */
+
+    if (QUANTIZE_PARALLEL_PIXELS > (uint32_t)hdr->width * hdr->height ||
+        1 >= (num_cpus = sysconf (_SC_NPROCESSORS_ONLN))) {
+        return 1;
+    }
+    if (QUANTIZE_MAX_THREADS < num_cpus) {
+        num_cpus = QUANTIZE_MAX_THREADS;
+    }
+    if (hdr->height < num_cpus) {
+        num_cpus = hdr->height;
+    }
+    return num_cpus;
+}
+
+
+/* 
+ * run_quantize_bands
+ *   DESCRIPTION: Run one quantization pass over all bands of a photo.
+ *                The calling thread handles the first band while helper
+ *                threads handle the others.  If a helper thread can't 
+ *                be created, the caller handles that band too.
+ *   INPUTS: fn -- the pass to run on each band
+ *           band -- the bands
+ *           num_bands -- number of bands
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: returns only after the pass is complete for all bands
+ */
+static void
+run_quantize_bands (void* (*fn) (void*), quantize_band_t* band, 
+		    int32_t num_bands)
+{
+    pthread_t tid[QUANTIZE_MAX_THREADS]; /* helper thread ids          */
+    int       started[QUANTIZE_MAX_THREADS]; /* helper thread running? */
+    int32_t   idx;			 /* index over bands           */
+
+    for (idx = 1; num_bands > idx; idx++) {
+        started[idx] = (0 == pthread_create (&tid[idx], NULL, fn, &band[idx]));
+    }
+    (void)(*fn) (&band[0]);
+    for (idx = 1; num_bands > idx; idx++) {
+        if (started[idx]) {
+	    (void)pthread_join (tid[idx], NULL);
+	} else {
+	    (void)(*fn) (&band[idx]);
+	}
+    }
+}
+
+
+/* 
+ * count_band
+ *   DESCRIPTION: First quantization pass: count the pixels of each 5:6:5
+ *                color in one band of rows.
+ *   INPUTS: arg -- the band (a quantize_band_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: adds to the band's histogram
+ */
+static void*
+count_band (void* arg)
+{
+    quantize_band_t* b = arg;	/* the band                   */
+    uint32_t*        hist;	/* the band's histogram       */
+    uint32_t         num_pix;	/* number of pixels in band   */
+    uint32_t         i;		/* index over pixels          */
+
+    /* This is a single increment per pixel. */
+    hist = b->histogram;
+    num_pix = (uint32_t)b->num_rows * b->hdr->width;
+    for (i = 0; num_pix > i; i++) {
+	hist[b->pixels[i]]++;
+    }
+    return NULL;
+}
+
+
+/* 
+ * remap_band
+ *   DESCRIPTION: Second quantization pass: map the pixels in one band
+ *                of rows into the palette.  The file stores rows from
+ *                bottom to top, whereas in memory we store the data in
+ *                the reverse order (top to bottom).
+ *   INPUTS: arg -- the band (a quantize_band_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: writes the band's rows of the photo's pixel data
+ */
+static void*
+remap_band (void* arg)
+{
+    quantize_band_t* b = arg;	/* the band                         */
+    const uint8_t*   lookup;	/* palette index for each node      */
+    const uint16_t*  row;	/* current row of the source pixels */
+    uint8_t*         out;	/* current row of the photo         */
+    uint16_t         width;	/* photo width in pixels            */
+    uint16_t         x;		/* index over columns               */
+    uint16_t         y;		/* index over rows (in file order)  */
+
+    lookup = b->tree->Lookup;
+    width = b->hdr->width;
+    row = b->pixels;
+    for (y = 0; b->num_rows > y; y++, row += width) {
+	out = b->img + width * (b->hdr->height - 1 - (b->first_row + y));
+	for (x = 0; width > x; x++) {
+	    out[x] = lookup[convert16_to_12 (row[x])];
+	}
+    }
+    return NULL;
+}
+
+
+/* 
+ * median_cut_palette
+ *   DESCRIPTION: Median cut quantizer.  The non-empty level-four nodes
+ *                start out in one box.  Until there are 192 boxes, the
+ *                box with the largest product of pixel count and extent
+ *                (along its widest channel) is split in two at the 
+ *                weighted median of that channel.  Each box then gives
+ *                one palette color, the mean of its pixels.
+ *   INPUTS: tree -- octree with Level4 filled in
+ *   OUTPUTS: palette -- the 192 palette colors
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reorders tree->Ranked; fills in tree->Lookup
+ */
+static void
+median_cut_palette (Octree* tree, uint8_t palette[192][3])
+{
+    static int (*const compare_axis[3]) (const void*, const void*) = {
+        compare_red, compare_green, compare_blue
+    };
+    mcut_box_t   box[192];	/* boxes of nodes                  */
+    int32_t      num_boxes;	/* number of boxes so far          */
+    int32_t      num_ranked;	/* number of non-empty nodes       */
+    int32_t      best;		/* box to split next               */
+    uint64_t     score;		/* splitting priority of best box  */
+    int32_t      idx;		/* index over boxes                */
+    int32_t      split;		/* first node of new box           */
+    uint32_t     half;		/* pixels wanted in first half     */
+    uint32_t     seen;		/* pixels in nodes passed so far   */
+    Octree_Node* node;		/* a node in the box               */
+    uint32_t     sum[3];	/* channel sums for a box          */
+    double       count_inverse; /* 1 / pixels in a box             */
+
+    (void)memset (palette, 0, 192 * 3);
+
+    /* Collect the non-empty level four nodes into one box. */
+    for (idx = 0, num_ranked = 0; 4096 > idx; idx++) {
+        if (0 != tree->Level4[idx].count) {
+	    tree->Ranked[num_ranked++] = tree->Level4[idx];
+	}
+    }
+    if (0 == num_ranked) {
+        return;
+    }
+    box[0].first = 0;
+    box[0].num_nodes = num_ranked;
+    measure_box (tree, &box[0]);
+    num_boxes = 1;
+
+    /* Split boxes until we run out of colors (or of boxes to split). */
+    while (192 > num_boxes) {
+	for (idx = 0, best = -1, score = 0; num_boxes > idx; idx++) {
+	    if (1 < box[idx].num_nodes && 
+	        score < (uint64_t)box[idx].pixels * box[idx].extent) {
+	        score = (uint64_t)box[idx].pixels * box[idx].extent;
+		best = idx;
+	    }
+	}
+	if (-1 == best) {
+	    break;
+	}
+
+	/* 
+	 * Sort the box's nodes along its widest channel and find the
+	 * weighted median.  Both halves must keep at least one node.
+	 */
+	node = &tree->Ranked[box[best].first];
+	qsort (node, box[best].num_nodes, sizeof (*node), 
+	       compare_axis[box[best].axis]);
+	half = box[best].pixels / 2;
+	for (split = 1, seen = node[0].count; 
+	     box[best].num_nodes - 1 > split && half > seen; split++) {
+	    seen += node[split].count;
+	}
+	box[num_boxes].first = box[best].first + split;
+	box[num_boxes].num_nodes = box[best].num_nodes - split;
+	box[best].num_nodes = split;
+	measure_box (tree, &box[best]);
+	measure_box (tree, &box[num_boxes]);
+	num_boxes++;
+    }
+
+    /* Each box gives the mean color of its pixels. */
+    for (idx = 0; num_boxes > idx; idx++) {
+        sum[0] = sum[1] = sum[2] = 0;
+	for (split = 0; box[idx].num_nodes > split; split++) {
+	    node = &tree->Ranked[box[idx].first + split];
+	    sum[0] += node->Sum_R;
+	    sum[1] += node->Sum_G;
+	    sum[2] += node->Sum_B;
+	    tree->Lookup[node->RGB] = 64 + idx;
+	}
+	count_inverse = 1.0 / box[idx].pixels;
+	palette[idx][0] = sum[0] * count_inverse;
+	palette[idx][1] = sum[1] * count_inverse;
+	palette[idx][2] = sum[2] * count_inverse;
+    }
+}
+
+
+/* 
+ * measure_box
+ *   DESCRIPTION: Count the pixels in a median cut box and find the
+ *                channel along which its node colors spread the most.
+ *   INPUTS: tree -- octree holding the nodes in Ranked
+ *           box -- the box (first and num_nodes must be filled in)
+ *   OUTPUTS: box -- pixels, axis, and extent are filled in
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+measure_box (const Octree* tree, mcut_box_t* box)
+{
+    int32_t  lo[3] = {15, 15, 15}; /* smallest node color per channel */
+    int32_t  hi[3] = {0, 0, 0};    /* largest node color per channel  */
+    int32_t  chan;		   /* index over channels             */
+    int32_t  idx;		   /* index over nodes                */
+    int32_t  val;		   /* one channel of a node's color   */
+    uint32_t rgb;		   /* a node's 12-bit color           */
+
+    box->pixels = 0;
+    for (idx = 0; box->num_nodes > idx; idx++) {
+        rgb = tree->Ranked[box->first + idx].RGB;
+	box->pixels += tree->Ranked[box->first + idx].count;
+	for (chan = 0; 3 > chan; chan++) {
+	    val = (rgb >> (8 - 4 * chan)) & 0xF;
+	    if (lo[chan] > val) {
+	        lo[chan] = val;
+	    }
+	    if (hi[chan] < val) {
+	        hi[chan] = val;
+	    }
+	}
+    }
+    box->axis = 0;
+    box->extent = hi[0] - lo[0];
+    for (chan = 1; 3 > chan; chan++) {
+        if (box->extent < hi[chan] - lo[chan]) {
+	    box->axis = chan;
+	    box->extent = hi[chan] - lo[chan];
+	}
+    }
+}
+
+
+/* 
+ * compare_red, compare_green, compare_blue
+ *   DESCRIPTION: qsort comparison functions that order Octree_Node 
+ *                structures by one channel of their level-four color,
+ *                breaking ties by the whole color so that the order 
+ *                does not depend on the sorting algorithm.
+ *   INPUTS: a, b -- pointers to the two nodes
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative if a comes first, positive if b comes first,
+ *                 or 0 if they are the same node
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_red (const void* a, const void* b)
+{
+    uint32_t ka = ((const Octree_Node*)a)->RGB; /* sort key for a */
+    uint32_t kb = ((const Octree_Node*)b)->RGB; /* sort key for b */
+
+    return (ka < kb ? -1 : (ka > kb ? 1 : 0));
+}
+
+static int
+compare_green (const void* a, const void* b)
+{
+    uint32_t ka = ((const Octree_Node*)a)->RGB; /* sort key for a */
+    uint32_t kb = ((const Octree_Node*)b)->RGB; /* sort key for b */
+
+    /* Move green to the top of the key. */
+    ka = ((ka & 0x0F0) << 8) | ka;
+    kb = ((kb & 0x0F0) << 8) | kb;
+    return (ka < kb ? -1 : (ka > kb ? 1 : 0));
+}
+
+static int
+compare_blue (const void* a, const void* b)
+{
+    uint32_t ka = ((const Octree_Node*)a)->RGB; /* sort key for a */
+    uint32_t kb = ((const Octree_Node*)b)->RGB; /* sort key for b */
+
+    /* Move blue to the top of the key. */
+    ka = ((ka & 0x00F) << 12) | ka;
+    kb = ((kb & 0x00F) << 12) | kb;
+    return (ka < kb ? -1 : (ka > kb ? 1 : 0));
+}
+
+
+/* 
+ * kmeans_palette
+ *   DESCRIPTION: Octree quantizer followed by a few k-means passes.
+ *                Each pass assigns every non-empty level-four node (at
+ *                the mean color of its pixels) to the nearest palette
+ *                color in use, then moves each palette color to the mean
+ *                of the pixels assigned to it.  A final assignment fills
+ *                in the lookup table for the finished palette.
+ *   INPUTS: tree -- octree with Level4 filled in
+ *   OUTPUTS: palette -- the 192 palette colors
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in tree->Lookup and tree->Level2
+ */
+static void
+kmeans_palette (Octree* tree, uint8_t palette[192][3])
+{
+    uint8_t      used[192];	/* palette color in use?          */
+    uint32_t     count[192];	/* pixels assigned to each color  */
+    uint32_t     sum[192][3];	/* channel sums for each color    */
+    int32_t      pass;		/* index over k-means passes      */
+    int32_t      idx;		/* index over nodes               */
+    int32_t      col;		/* index over palette colors      */
+    int32_t      best;		/* nearest palette color          */
+    double       best_dist;	/* distance to nearest color      */
+    double       dist;		/* distance to a palette color    */
+    double       d;		/* difference in one channel      */
+    double       mean[3];	/* mean color of a node's pixels  */
+    Octree_Node* node;		/* a level four node              */
+
+    /* Start from the octree palette, and note the colors it uses. */
+    build_palette (tree, palette);
+    (void)memset (used, 0, sizeof (used));
+    for (idx = 0; 4096 > idx; idx++) {
+        if (0 != tree->Level4[idx].count) {
+	    used[tree->Lookup[idx] - 64] = 1;
+	}
+    }
+
+    for (pass = 0; KMEANS_PASSES >= pass; pass++) {
+	(void)memset (count, 0, sizeof (count));
+	(void)memset (sum, 0, sizeof (sum));
+
+	/* Assign each node to the nearest palette color in use. */
+	for (idx = 0; 4096 > idx; idx++) {
+	    node = &tree->Level4[idx];
+	    if (0 == node->count) {
+	        continue;
+	    }
+	    mean[0] = (double)node->Sum_R / node->count;
+	    mean[1] = (double)node->Sum_G / node->count;
+	    mean[2] = (double)node->Sum_B / node->count;
+	    best = tree->Lookup[idx] - 64;
+	    best_dist = HUGE_VAL;
+	    for (col = 0; 192 > col; col++) {
+	        if (!used[col]) {
+		    continue;
+		}
+		d = mean[0] - palette[col][0];
+		dist = d * d;
+		d = mean[1] - palette[col][1];
+		dist += d * d;
+		d = mean[2] - palette[col][2];
+		dist += d * d;
+		if (best_dist > dist) {
+		    best_dist = dist;
+		    best = col;
+		}
+	    }
+	    tree->Lookup[idx] = 64 + best;
+	    count[best] += node->count;
+	    sum[best][0] += node->Sum_R;
+	    sum[best][1] += node->Sum_G;
+	    sum[best][2] += node->Sum_B;
+	}
+
+	/* The last pass only fills in the lookup table. */
+	if (KMEANS_PASSES == pass) {
+	    break;
+	}
+
+	/* Move each color to the mean of its pixels (rounded). */
+	for (col = 0; 192 > col; col++) {
+	    if (0 != count[col]) {
+		palette[col][0] = (sum[col][0] + count[col] / 2) / count[col];
+		palette[col][1] = (sum[col][1] + count[col] / 2) / count[col];
+		palette[col][2] = (sum[col][2] + count[col] / 2) / count[col];
+	    }
+	}
+    }
+}
+
+
+/* 
+ * default_quantizer
+ *   DESCRIPTION: Get the quantizer used for photos when none is given.
+ *                This is the octree quantizer unless another has been
+ *                chosen with set_default_quantizer or named in the 
+ *                ADVENTURE_QUANTIZER environment variable.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the default quantizer
+ *   SIDE EFFECTS: reads the environment the first time it is called
+ */
+quantizer_t
+default_quantizer ()
+{
+    (void)pthread_once (&default_q_once, init_default_quantizer);
+    return default_q;
+}
+
+
+/* 
+ * set_default_quantizer
+ *   DESCRIPTION: Change the quantizer used for photos when none is given.
+ *                Overrides the ADVENTURE_QUANTIZER environment variable.
+ *   INPUTS: q -- the new default quantizer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+set_default_quantizer (quantizer_t q)
+{
+    (void)pthread_once (&default_q_once, init_default_quantizer);
+    if (NUM_QUANTIZERS > (uint32_t)q) {
+        default_q = q;
+    }
+}
+
+
+/* 
+ * quantizer_name
+ *   DESCRIPTION: Get the name of a quantizer.
+ *   INPUTS: q -- the quantizer
+ *   OUTPUTS: none
+ *   RETURN VALUE: the name (a string), or "?" for a bad quantizer
+ *   SIDE EFFECTS: none
+ */
+const char*
+quantizer_name (quantizer_t q)
+{
+    return (NUM_QUANTIZERS > (uint32_t)q ? engine[q].name : "?");
+}
+
+
+/* 
+ * quantizer_by_name
+ *   DESCRIPTION: Find a quantizer by name.  The match is not sensitive
+ *                to case.
+ *   INPUTS: name -- the name of the quantizer
+ *   OUTPUTS: none
+ *   RETURN VALUE: the quantizer, or NUM_QUANTIZERS if none matches
+ *   SIDE EFFECTS: none
+ */
+quantizer_t
+quantizer_by_name (const char* name)
+{
+    int32_t q; /* index over quantizers */
+
+    for (q = 0; NUM_QUANTIZERS > q; q++) {
+        if (0 == strcasecmp (name, engine[q].name)) {
+	    return q;
+	}
+    }
+    return NUM_QUANTIZERS;
+}
+
+
+/* 
+ * photo_hash
+ *   DESCRIPTION: Hash a buffer to 64 bits.  The buffer is consumed eight
+ *                bytes at a time, each word mixed in with a multiply and
+ *                a shift, so the hash runs at close to memory speed.  It
+ *                is good enough to tell photos apart and to catch damage
+ *                to a file, but is not meant to resist attack.
+ *   INPUTS: buf -- the data to hash
+ *           len -- length of data in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the hash
+ *   SIDE EFFECTS: none
+ */
+uint64_t
+photo_hash (const void* buf, size_t len)
+{
+    const uint8_t* b = buf;			/* next byte to hash    */
+    uint64_t       h = 0x243F6A8885A308D3ULL ^ len; /* running hash */
+    uint64_t       word;			/* eight bytes of data  */
+
+    for (; 8 <= len; b += 8, len -= 8) {
+	(void)memcpy (&word, b, 8);
+	h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+	h ^= h >> 29;
+    }
+    for (word = 0; 0 < len; len--) {
+        word = (word << 8) | b[len - 1];
+    }
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+
+/* 
+ * photo_source_hash
+ *   DESCRIPTION: Hash the contents of a room photo file: its header and
+ *                its 5:6:5 RGB pixels.  The two are hashed separately so
+ *                that the pixels need not follow the header in memory.
+ *   INPUTS: hdr -- the photo header
+ *           pixels -- the photo pixels, in file order
+ *   OUTPUTS: none
+ *   RETURN VALUE: the hash
+ *   SIDE EFFECTS: none
+ */
+uint64_t
+photo_source_hash (const photo_header_t* hdr, const uint16_t* pixels)
+{
+    return (photo_hash (hdr, sizeof (*hdr)) * 31 ^
+	    photo_hash (pixels, (size_t)hdr->width * hdr->height * 
+	    		sizeof (pixels[0])));
+}
+
+
+/* 
+ * init_default_quantizer
+ *   DESCRIPTION: Pick up the default quantizer from the environment, if
+ *                it is named there.  Called once, via pthread_once.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change default_q; complains on stderr about a
+ *                 name it doesn't know
+ */
+static void
+init_default_quantizer ()
+{
+    const char* name; /* quantizer name from the environment */
+    quantizer_t q;    /* the quantizer with that name        */
+
+    if (NULL == (name = getenv (QUANTIZER_ENV)) || '\0' == *name) {
+        return;
+    }
+    if (NUM_QUANTIZERS == (q = quantizer_by_name (name))) {
+        fprintf (stderr, "Unknown quantizer %s; using %s.\n", name,
+		 quantizer_name (default_q));
+	return;
+    }
+    default_q = q;
+}
+
+
+////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
+
+/* 
+   Interface Description:
+   This function initializes an Octree structure for color quantization purposes.
+   The Octree consists of two levels: Level2 and Level4, with Level2 containing 64 nodes and Level4 containing 4096 nodes.
+   Each node in the Octree_Node structure stores color information (RGB), sums of color components (Sum_R, Sum_G, Sum_B),
+   a count of the number of colors represented by the node (count).
+   The tree is filled in place (it is ~420 KB with the Ranked, Lookup, and Histogram
+   scratch space, too big to pass around by value or keep on a thread stack).
+
+   Parameters:
+   - Tree: Pointer to the Octree structure to initialize.
+*/
+
+// Function to initialize an octree in place
+void init_Octree(Octree* Tree) {
+    int i;
+
+    // Initialize both level 2 nodes
+    for (i = 0; i < 64; i++) {
+        Tree->Level2[i].count = 0;
+        Tree->Level2[i].Sum_R = 0;
+        Tree->Level2[i].Sum_G = 0;
+        Tree->Level2[i].Sum_B = 0;
+        Tree->Level2[i].RGB = i;
+    }
+
+    // Initialize all level 4 nodes
+    for (i = 0; i < 4096; i++) {
+        Tree->Level4[i].count = 0;
+        Tree->Level4[i].Sum_R = 0;
+        Tree->Level4[i].Sum_G = 0;
+        Tree->Level4[i].Sum_B = 0;
+        Tree->Level4[i].RGB = i;
+    }
+
+    // Clear the color histogram for the first pass
+    memset(Tree->Histogram, 0, sizeof(Tree->Histogram));
+}
+
+
+/*
+   Interface Description:
+   This function fills in the level 4 nodes from the color histogram built in the first pass.
+   All 16 colors that share a level 4 node differ only in the low bits of their channels, so
+   each color's count is simply added to its node along with the count-weighted channel values.
+   The cost is fixed (65536 histogram entries) no matter how many pixels the photo has.
+
+   Parameters:
+   - Tree: Pointer to the Octree, with Histogram filled in.
+*/
+void fill_Level4(Octree* Tree) {
+    uint32_t pixel;
+    uint32_t count;
+    Octree_Node* node;
+
+    for (pixel = 0; pixel < 65536; pixel++) {
+        if (0 == (count = Tree->Histogram[pixel])) {
+            continue;
+        }
+        node = &Tree->Level4[convert16_to_12(pixel)];
+        node->count += count;
+        node->Sum_R += count * extractRed(pixel);
+        node->Sum_G += count * extractGreen(pixel);
+        node->Sum_B += count * extractBlue(pixel);
+    }
+}
+
+
+/*
+   Interface Description:
+   This function picks the palette colors from the filled-in level 4 nodes. Only the 128 most
+   popular nodes need to be found, so instead of sorting all 4096 nodes we partially order the
+   non-empty ones (select_top_nodes) and sort just those 128. They become palette colors 0-127
+   (VGA colors 64-191). The remaining nodes are folded into their level 2 parents, which give
+   palette colors 128-191 (VGA colors 192-255). The Lookup table records the VGA color for
+   every non-empty level 4 node.
+
+   Parameters:
+   - Tree: Pointer to the Octree, with Level4 filled in.
+   - palette: The 192 palette colors to fill in.
+*/
+void build_palette(Octree* Tree, uint8_t palette[192][3]) {
+    int numRanked = 0;
+    int top;
+    int i;
+    int L2_index;
+    Octree_Node* node;
+
+    // Colors not used by the photo are left black
+    memset(palette, 0, 192 * 3);
+
+    // Collect the non-empty level 4 nodes
+    for (i = 0; i < 4096; i++) {
+        if (Tree->Level4[i].count != 0) {
+            Tree->Ranked[numRanked++] = Tree->Level4[i];
+        }
+    }
+
+    // Bring the most popular 128 to the front, then sort only those
+    top = (numRanked < 128 ? numRanked : 128);
+    select_top_nodes(Tree->Ranked, numRanked, top);
+    qsort(Tree->Ranked, top, sizeof(Tree->Ranked[0]), compareFunction);
+
+    // Set up the first 128 colors of the palette (L4)
+    for (i = 0; i < top; i++) {
+        node = &Tree->Ranked[i];
+        double count_inverse = 1.0 / node->count;
+        palette[i][0] = node->Sum_R * count_inverse;
+        palette[i][1] = node->Sum_G * count_inverse;
+        palette[i][2] = node->Sum_B * count_inverse;
+        Tree->Lookup[node->RGB] = 64 + i;
+    }
+
+    // Use the remaining L4 colors to set up L2
+    for (i = top; i < numRanked; i++) {
+        node = &Tree->Ranked[i];
+        L2_index = convert12_to_6(node->RGB);
+
+        Tree->Level2[L2_index].Sum_R += node->Sum_R;
+        Tree->Level2[L2_index].Sum_G += node->Sum_G;
+        Tree->Level2[L2_index].Sum_B += node->Sum_B;
+        Tree->Level2[L2_index].count += node->count;
+        Tree->Lookup[node->RGB] = 64 + 128 + L2_index;
+    }
+
+    // Set up the last 64 colors of the palette (L2)
+    for (i = 0; i < 64; i++) {
+        if (Tree->Level2[i].count == 0) {
+            continue;
+        }
+        double count_inverse = 1.0 / Tree->Level2[i].count;
+        palette[i + 128][0] = Tree->Level2[i].Sum_R * count_inverse;
+        palette[i + 128][1] = Tree->Level2[i].Sum_G * count_inverse;
+        palette[i + 128][2] = Tree->Level2[i].Sum_B * count_inverse;
+    }
+}
+
+
+/*
+   Interface Description:
+   This function partially orders an array of nodes (quickselect) so that the k nodes that come
+   first under compareFunction occupy positions 0 to k-1, in no particular order. It runs in
+   linear expected time, rather than the n log n of a full sort.
+
+   Parameters:
+   - nodes: The array of nodes to reorder.
+   - n: The number of nodes in the array.
+   - k: The number of nodes to bring to the front.
+*/
+void select_top_nodes(Octree_Node* nodes, int n, int k) {
+    int lo = 0;
+    int hi = n - 1;
+    int i;
+    int j;
+    Octree_Node pivot;
+    Octree_Node tmp;
+
+    if (k <= 0 || k >= n) {
+        return;
+    }
+    while (lo < hi) {
+        // Partition around the middle node (Hoare scheme)
+        pivot = nodes[lo + (hi - lo) / 2];
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (compareFunction(&nodes[i], &pivot) < 0) {
+                i++;
+            }
+            while (compareFunction(&nodes[j], &pivot) > 0) {
+                j--;
+            }
+            if (i <= j) {
+                tmp = nodes[i];
+                nodes[i] = nodes[j];
+                nodes[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+
+        // Keep going only on the side holding position k-1
+        if (k - 1 <= j) {
+            hi = j;
+        } else if (k - 1 >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+}
+
+
+/*
+16-bit pixel format:   0bRRRRRGGGGGGBBBBB
+                       |   |      |     |
+                       |   |      |     Extract the 4-bit Blue component
+                       |   |      Extract the 4-bit Green component
+                       |   Extract the 4-bit Red component
+                       Left-shift Red by 4 bits
+                       Left-shift Green by 4 bits
+                       Right-shift Blue by 1 bit (to adjust for its position)
+
+12-bit output format:  0bRRRR-GGGG-BBBB
+*/
+
+uint32_t convert16_to_12(uint16_t pixel) {
+    // Extract the 4 most significant bits of each color component
+    uint32_t Red = (pixel >> 12) & 0xF;  // Extract 4 bits for Red (RRRR)
+    uint32_t Green = (pixel >> 7) & 0xF; // Extract 4 bits for Green (GGGG)
+    uint32_t Blue = (pixel >> 1) & 0xF;  // Extract 4 bits for Blue (BBBB)
+
+    // Combine and pack the components into a 12-bit color
+    // Math explanation for combining:
+    // Red is shifted 8 bits to the left (RRRR0000)
+    // Green is shifted 4 bits to the left (0000GGGG)
+    // Blue is as-is (0000BBBB)
+    // Combining them using bitwise OR to get 12-bit format (RRRRGGGGBBBB)
+    uint32_t result = ((Red << 8) | (Green << 4) | Blue);
+
+    return result;
+}
+
+/*
+Input 12-bit pixel:  0bRRRRGGGGBBBB
+                      |  |     |    |
+                      |  |     |    Extract the 4-bit Blue component
+                      |  |     Extract the 4-bit Green component
+                      |  Extract the 4-bit Red component
+                      Left-shift Red by Red_6off bits
+                      Left-shift Green by Green_6off bits
+
+Output 6-bit value:   0bRRGGBB
+*/
+
+uint32_t convert12_to_6(uint16_t pixel) {
+    // Extract the 2 most significant bits of each color component
+    uint32_t Red = (pixel >> 10) & 0x3;  // Extract 2 bits for Red (RR)
+    uint32_t Green = (pixel >> 6) & 0x3; // Extract 2 bits for Green (GG)
+    uint32_t Blue = (pixel >> 2) & 0x3;  // Extract 2 bits for Blue (BB)
+
+    // Combine and pack the components into a 6-bit color
+    // Math explanation for combining:
+    // Red is shifted 4 bits to the left (RR00)
+    // Green is shifted 2 bits to the left (00GG)
+    // Blue is as-is (BB)
+    // Combining them using bitwise OR to get 6-bit format (RRGGBB)
+    uint32_t result = ((Red << 4) | (Green << 2) | Blue);
+
+    return result;
+}
+
+// Function to extract the Red component from a 16-bit RGB pixel
+uint32_t extractRed(uint16_t pixel) {
+    // Right-shift by the number of bits for Green and Blue (5 bits in total)
+    // to extract the 5-bit Red component, and then left-shift by 1 bit.
+    return ((pixel >> 11) & 0x1F) << 1;
+}
+
+// Function to extract the Green component from a 16-bit RGB pixel
+uint32_t extractGreen(uint16_t pixel) {
+    // Right-shift by the number of bits for Blue (5 bits) to extract the
+    // 5-bit Green component.
+    return ((pixel >> 5) & 0x3F);
+}
+
+// Function to extract the Blue component from a 16-bit RGB pixel
+uint32_t extractBlue(uint16_t pixel) {
+    // Mask the lowest 5 bits to extract the 5-bit Blue component.
+    return (pixel & 0x1F) << 1;
+}
+
+/* 
+   Interface Description:
+   This function is used as a comparison function for ordering Octree_Node structures
+   in descending order based on their 'count' member, with ties broken by ascending 'RGB'
+   so that the palette does not depend on the sorting algorithm. It is intended to be used
+   with the standard library function 'qsort' and with select_top_nodes.
+
+   Parameters:
+   - a: Pointer to the first Octree_Node structure to compare.
+   - b: Pointer to the second Octree_Node structure to compare.
+
+   Returns:
+   - A negative value if 'a' comes first (larger count, or same count and smaller RGB).
+   - A positive value if 'b' comes first.
+   - 0 if they are the same node.
+*/
+
+int compareFunction(const void *a, const void *b) {
+    const Octree_Node* A = (const Octree_Node*)a;
+    const Octree_Node* B = (const Octree_Node*)b;
+
+    // Compare without subtracting, which can overflow for large counts
+    if (A->count != B->count) {
+        return (A->count > B->count ? -1 : 1);
+    }
+    return (A->RGB < B->RGB ? -1 : (A->RGB > B->RGB ? 1 : 0));
+}
+////////////////////////////////////////////////////////////////* MY OCTREE NEEDS*/////////////////////////////////////////////////////////////////
@@ -0,0 +1,83 @@
+/*									tab:8
+ *
+ * quantize.h - header file for room photo color quantization
+ *
+ * The quantizers choose the 192 palette colors (VGA colors 64 to 255)
+ * for a room photo and map each 5:6:5 RGB pixel of the photo to one of
+ * them.  All of them work from the same histogram of level-four octree
+ * nodes (4 bits per channel), so they differ only in how the palette
+ * is picked; see quantize.c for the details of each.
+ */
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "photo_headers.h"
+
+
+/* 
+ * Version of the quantizer output; change it whenever any engine would
+ * pick a different palette or mapping, so that precompiled photos made
+ * by older code are ignored.
+ */
+#define QUANTIZER_VERSION 1
+
+/* the available quantizers (palette selection engines) */
+typedef enum {
+    QUANT_OCTREE,	/* two-level octree: 128 level-4 + 64 level-2 */
+    QUANT_MEDIAN_CUT,	/* median cut over the level-4 nodes          */
+    QUANT_KMEANS,	/* octree, then refined with k-means passes   */
+    NUM_QUANTIZERS
+} quantizer_t;
+
+/* 
+ * Quantize a photo given as 5:6:5 RGB pixels in file order (lower left
+ * first, rows from bottom to top).  Fills in the palette (6 bits per
+ * channel) and the one-byte pixels, stored from the upper left.
+ * Returns 0 on success, or -1 if out of memory.
+ */
+extern int32_t quantize_photo (quantizer_t q, const photo_header_t* hdr,
+			       const uint16_t* pixels, 
+			       uint8_t palette[192][3], uint8_t* img);
+
+/* Get the quantizer used when none is specified for a photo. */
+extern quantizer_t default_quantizer ();
+
+/* Change the quantizer used when none is specified for a photo. */
+extern void set_default_quantizer (quantizer_t q);
+
+/* Get name of a quantizer. */
+extern const char* quantizer_name (quantizer_t q);
+
+/* Find a quantizer by name; returns NUM_QUANTIZERS if there is none. */
+extern quantizer_t quantizer_by_name (const char* name);
+
+/* 
+ * Fast 64-bit hash of a buffer, used to key and check quantized photos
+ * (not cryptographic).
+ */
+extern uint64_t photo_hash (const void* buf, size_t len);
+
+/* Hash of a room photo (header and 5:6:5 pixels), as photo_hash. */
+extern uint64_t photo_source_hash (const photo_header_t* hdr,
+				   const uint16_t* pixels);
+
+//////////////////////////////////////////////////////////////////////// my inits  /////////////////////////////////////////////////////////////////////
+struct Octree; /* defined in quantize.c */
+struct Octree_Node; /* defined in quantize.c */
+void init_Octree(struct Octree* Tree);
+void fill_Level4(struct Octree* Tree);
+void build_palette(struct Octree* Tree, uint8_t palette[192][3]);
+void select_top_nodes(struct Octree_Node* nodes, int n, int k);
+uint32_t convert16_to_12(uint16_t pixel);
+uint32_t convert12_to_6(uint16_t pixel);
+uint32_t extractRed(uint16_t pixel);
+uint32_t extractGreen(uint16_t pixel);
+uint32_t extractBlue(uint16_t pixel);
+int compareFunction(const void *a, const void *b);
+//////////////////////////////////////////////////////////////////////// my inits /////////////////////////////////////////////////////////////////////
+
+#endif /* QUANTIZE_H */
@@ -34,16 +34,116 @@
  */
  
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "arena.h"
 #include "assert.h"
+#include "pack.h"
 #include "photo.h"
 #include "world.h"
 
 
 /* parameters defined for this file */
 
+/* 
+ * build_world reads in the image files with up to BUILD_THREADS threads
+ * (including the caller), but no more threads than processors.
+ */
+#if !defined(BUILD_THREADS)
+#define BUILD_THREADS 8
+#endif
+
+/* 
+ * Room photos are read in only when first needed (see room_photo).  To
+ * keep the photos in memory within ROOM_PHOTO_BUDGET bytes (or the 
+ * number of bytes given by the ROOM_BUDGET_ENV environment variable),
+ * photos of rooms not being shown are thrown out, least recently used
+ * first.  Unless ROOM_PREFETCH is 0, a prefetch thread reads in the 
+ * photos of the rooms next to the one shown, those the player has most
+ * often moved into first.
+ */
+#if !defined(ROOM_PHOTO_BUDGET)
+#define ROOM_PHOTO_BUDGET (64 * 1024 * 1024)
+#endif
+#if !defined(ROOM_BUDGET_ENV)
+#define ROOM_BUDGET_ENV "ADVENTURE_ROOM_BUDGET"
+#endif
+#if !defined(ROOM_PREFETCH)
+#define ROOM_PREFETCH 1
+#endif
+
+/* 
+ * Setting the ROOM_RELOAD_ENV environment variable to "1" turns on hot
+ * reloading for development: a thread watches the directories holding 
+ * the room photos, reads a photo in again whenever its file (or its
+ * precompiled photo) changes, and leaves it for the game loop to swap
+ * in between ticks (see apply_photo_reloads).  Photos read from the 
+ * asset pack are not affected by changes to the files.
+ */
+#if !defined(ROOM_RELOAD_ENV)
+#define ROOM_RELOAD_ENV "ADVENTURE_HOT_RELOAD"
+#endif
+
+/* 
+ * After building the world from the image files, build_world starts a
+ * thread that saves the object images and room photos into a world 
+ * image once the first room has been drawn (see write_world_image).  
+ * The image is WORLD_IMAGE_FILE in the photo cache directory (see 
+ * photo_cache_dir), or the file named by the WORLD_IMAGE_ENV 
+ * environment variable; an empty name (or, without the variable, a 
+ * photo cache that is turned off) turns the world image off.  Later 
+ * runs map the world image and use its contents in place instead of 
+ * reading the files.  The image is rebuilt whenever the tables below,
+ * the image files, or the quantizer change (see world_signature).
+ */
+#if !defined(WORLD_IMAGE_FILE)
+#define WORLD_IMAGE_FILE "world_image"
+#endif
+#if !defined(WORLD_IMAGE_ENV)
+#define WORLD_IMAGE_ENV "ADVENTURE_WORLD_IMAGE"
+#endif
+#define WORLD_IMAGE_MAGIC   "WIM1"
+#define WORLD_IMAGE_VERSION 2
+
+/* 
+ * Each room indexes its objects by the bands of rows and of columns of
+ * its photo that they cover, so that drawing a line of the photo need 
+ * only look at the objects in one band (see room_objects_on_row and
+ * room_objects_on_column).  Bands are ROOM_BAND (1 << ROOM_BAND_SHIFT)
+ * pixels wide.  Each room has ROOM_BANDS bands of each kind; they wrap
+ * around (row y is in band (y / ROOM_BAND) % ROOM_BANDS), so a band of
+ * a very large photo also holds objects from farther along, which 
+ * drawing just skips.  A room's bands are allocated when the first 
+ * object is put into it, so rooms that never hold objects cost nothing.
+ */
+#if !defined(ROOM_BAND_SHIFT)
+#define ROOM_BAND_SHIFT 5
+#endif
+#if !defined(ROOM_BANDS)
+#define ROOM_BANDS 64
+#endif
+#define ROOM_BAND (1 << ROOM_BAND_SHIFT)
+
+/*
+ * A synthetic world generated by mkworld (see mkworld.c) can be added to
+ * the real one for stress testing by defining STRESS_WORLD as the name of
+ * its header (e.g., "make STRESS_WORLD=stress/world.h").  The header is
+ * included once here for the numbers of rooms and objects, then again 
+ * within room_data and obj_data for their entries.  The player starts in
+ * the first synthetic room.
+ */
+#if defined(STRESS_WORLD)
+#include STRESS_WORLD
+#endif
+
 /* room identifiers */
 enum {
     R_NONE = -1,
@@ -122,6 +222,11 @@ enum {
     R_REM_ICE,		/* the ice fields near rem. sen. lab */
     R_REM_LAB,		/* part of a remote sensing lab      */
 
+#if defined(STRESS_WORLD)
+    R_STRESS,		/* the synthetic rooms               */
+    R_STRESS_LAST = R_STRESS + STRESS_ROOMS - 1,
+#endif
+
     N_ROOMS
 };
 
@@ -150,6 +255,11 @@ enum {
     O_ROBOT_LIVE,	/* lockpicking robot with new control program */
     O_MIMO_CARD,	/* a MIMO card for planes                     */
 
+#if defined(STRESS_WORLD)
+    O_STRESS,		/* the synthetic objects                      */
+    O_STRESS_LAST = O_STRESS + STRESS_OBJECTS - 1,
+#endif
+
     N_OBJECTS
 };
 
@@ -173,17 +283,59 @@ enum {
 
 /* types local to this file (declared in types.h) */
 
+/*
+ * A room photo, read in from its file only when needed.  Each room 
+ * points to the slot of the photo it shows, so swapping photos (see 
+ * do_photo_swap) swaps slots.  The photo and loading fields are 
+ * protected by slot_lock, as is saving, which keeps the photo from being
+ * thrown out or replaced while the world image writer saves it.
+ */
+typedef struct photo_slot_t photo_slot_t;
+struct photo_slot_t {
+    const char*    filename;	/* file holding the photo          */
+    photo_header_t hdr;		/* size of the photo               */
+    photo_t*       photo;	/* the photo, or NULL if not in    */
+    photo_t*       reloaded;	/* new photo waiting to be swapped */
+    size_t         bytes;	/* memory used by the photo        */
+    uint32_t       last_used;	/* slot_clock when last used       */
+    int32_t        loading;	/* photo is being read in          */
+    int32_t        saving;	/* photo is being saved            */
+    int            watch;	/* inotify watch on its directory  */
+    const void*    saved;	/* photo in world image, or NULL   */
+    size_t         saved_len;	/* length of photo in world image  */
+};
+
+/*
+ * The objects in a room that cover part of a band of rows or columns of
+ * its photo, in the order in which they are drawn (that of the room's
+ * contents list).  The fields drawing needs are copied into parallel
+ * arrays (see obj_list_t), all in one block of cap entries.
+ */
+typedef struct obj_band_t obj_band_t;
+struct obj_band_t {
+    object_t** obj;		/* objects in band            */
+    image_t**  img;		/* their images               */
+    uint16_t*  x;		/* their x positions          */
+    uint16_t*  y;		/* their y positions          */
+    uint16_t*  width;		/* their image widths         */
+    uint16_t*  height;		/* their image heights        */
+    int32_t    num;		/* number of objects in band  */
+    int32_t    cap;		/* space allocated for arrays */
+};
+
 /*
  * The structure representing a room in the world.  The backpack/inventory 
  * is also a 'room' (#0, R_INVENTORY). 
  */
 struct room_t {
-    const char* name;		/* name of room                   */
-    photo_t*    view;		/* photo currently shown for room */
-    object_t*   contents; 	/* linked list of objects in room */
-    room_t*     left;   	/* room to the "left"             */
-    room_t*     enter;  	/* doors, etc.                    */
-    room_t*     right;  	/* room to the "right"            */
+    const char*   name;		/* name of room                   */
+    photo_slot_t* view;		/* photo currently shown for room */
+    object_t*     contents; 	/* linked list of objects in room */
+    room_t*       left;   	/* room to the "left"             */
+    room_t*       enter;  	/* doors, etc.                    */
+    room_t*       right;  	/* room to the "right"            */
+    obj_band_t*   row_band;	/* objects by rows, or NULL       */
+    obj_band_t*   col_band;	/* objects by columns, or NULL    */
 };
 
 /*
@@ -359,6 +511,12 @@ static const room_data_t room_data[N_ROOMS] = {
                     R_AIR_RIO,   R_REM_LAB,      R_NONE},
     {  R_REM_LAB, "Remote Sensing Lab", "images/rsenselab.photo", 
                        R_NONE,   R_REM_ICE,      R_NONE}
+
+#if defined(STRESS_WORLD)
+#define STRESS_ROOM_DATA
+#include STRESS_WORLD
+#undef STRESS_ROOM_DATA
+#endif
 };
 
 /*
@@ -401,6 +559,12 @@ static const obj_data_t obj_data[N_OBJECTS] = {
     {O_ROBOT_DEAD, "robot", "images/robot.obj", R_MNTL_LAB3, -1, -1},
     {O_ROBOT_LIVE, "robot", "images/robot.obj", R_NONE, -1, -1},
     { O_MIMO_CARD, "mimo", "images/mimo.obj", R_STATUE, -1, -1}
+
+#if defined(STRESS_WORLD)
+#define STRESS_OBJ_DATA
+#include STRESS_WORLD
+#undef STRESS_OBJ_DATA
+#endif
 };
 
 /*
@@ -421,6 +585,55 @@ static const swap_data_t swap_data[N_SWAPS] = {
     {SWAP_CAR, "images/caropen.photo"}		/* open/closed car photos */
 };
 
+/*
+ * The files named in the data above are independent of one another, so
+ * build_world reads them all in at once, as a pool of tasks handed out 
+ * to several threads, before setting up the world from them.  The 
+ * tasks appear in the order of room_data, then obj_data, then swap_data.
+ * Only the sizes of photos are read at this point.
+ */
+typedef struct asset_task_t asset_task_t;
+struct asset_task_t {
+    const char*   filename;	/* file to read                      */
+    photo_slot_t* slot;		/* photo slot, or NULL for an object */
+    image_t*      img;		/* object image read in              */
+    int32_t       ok;		/* file was read successfully        */
+};
+
+typedef struct asset_pool_t asset_pool_t;
+struct asset_pool_t {
+    asset_task_t*   task;	/* tasks                           */
+    int32_t         num_tasks;	/* number of tasks                 */
+    int32_t         next;	/* first task not yet handed out   */
+    pthread_mutex_t lock;	/* protects next                   */
+};
+
+/*
+ * The world image file (see WORLD_IMAGE_FILE).  The header is followed
+ * by the saved room photos (see save_photo), each starting on a 
+ * QPHOTO_ALIGN boundary so that its pixels are page-aligned, and the
+ * saved object images (see save_obj_image), each on an ARENA_ALIGN 
+ * boundary.  Entries are located by file offset, and appear in the 
+ * order of room_data then swap_data, and of obj_data.  A photo that
+ * could not be saved (a panorama) has length 0 and is read from its 
+ * file when needed.
+ */
+typedef struct world_entry_t world_entry_t;
+struct world_entry_t {
+    uint64_t       offset;	/* file offset of saved data       */
+    uint64_t       length;	/* length of saved data in bytes   */
+    photo_header_t hdr;		/* photo size (photos only)        */
+};
+
+typedef struct world_image_t world_image_t;
+struct world_image_t {
+    char          magic[4];	/* WORLD_IMAGE_MAGIC (no NUL)      */
+    uint32_t      version;	/* WORLD_IMAGE_VERSION             */
+    uint64_t      signature;	/* world_signature () at build     */
+    world_entry_t photo[N_ROOMS + N_SWAPS]; /* saved room photos  */
+    world_entry_t obj[N_OBJECTS];	    /* saved object images */
+};
+
 
 /* functions local to this file--see function headers for details */
 static void do_photo_swap (room_t* r, int32_t which);
@@ -432,6 +645,25 @@ static object_t* obj_special_get (room_t* r, const char* arg);
 static int32_t player_flag_is_set (int32_t fnum);
 static void player_set_flag (int32_t fnum);
 static void remove_object (object_t* o);
+static void alloc_bands (room_t* r);
+static void band_insert (obj_band_t* band, int32_t first, int32_t len,
+			 object_t* o);
+static void band_remove (obj_band_t* band, int32_t first, int32_t len,
+			 const object_t* o);
+static void* asset_worker (void* arg);
+static void load_assets (asset_task_t* task, int32_t num_tasks);
+static photo_t* load_slot (photo_slot_t* s);
+static void evict_photos ();
+static void count_move (const room_t* from, const room_t* to);
+static void* prefetch_neighbors (void* arg);
+static int32_t same_photo_file (const char* fname, const char* name);
+static void* watch_photos (void* arg);
+static uint64_t sign_data (uint64_t sig, const void* buf, size_t len);
+static uint64_t sign_file (uint64_t sig, const char* fname);
+static uint64_t world_signature ();
+static int32_t world_image_name (char* fname, size_t len);
+static int32_t restore_world_image (asset_task_t* task);
+static void* write_world_image (void* arg);
 
 
 /* file-scope variables */
@@ -443,7 +675,36 @@ static void remove_object (object_t* o);
 static room_t   room[N_ROOMS];			     /* rooms                */
 static object_t object[N_OBJECTS];		     /* objects              */
 static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
-static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
+static photo_slot_t* swap_photo[N_SWAPS];            /* swapping photos      */
+
+/* 
+ * Room photos, read in lazily: one slot for each entry in room_data,
+ * followed by one for each entry in swap_data.  The slot last used by
+ * room_photo (cur_slot) is never thrown out, so the photo returned by
+ * room_photo stays valid until the next call.  Photos thrown out by 
+ * the prefetch thread are freed by the drawing thread (the one calling
+ * room_photo), which owns photo.c's row cache.
+ */
+static photo_slot_t    photo_slot[N_ROOMS + N_SWAPS];  /* the photos      */
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  slot_loaded = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  prefetch_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  reload_taken = PTHREAD_COND_INITIALIZER;
+static size_t          slot_budget;	/* memory allowed for photos      */
+static size_t          slot_bytes;	/* memory used by photos read in  */
+static uint32_t        slot_clock;	/* ticks on each use of a slot    */
+static photo_slot_t*   cur_slot;	/* slot last used by room_photo   */
+static const room_t*   shown_room;	/* room last passed to room_photo */
+static const room_t*   prefetch_room;	/* room to prefetch around        */
+static photo_t*        evicted[N_ROOMS + N_SWAPS]; /* photos to free      */
+static int32_t         num_evicted;	/* number of photos to free       */
+static int32_t         prefetching;	/* prefetch thread is running     */
+static int32_t         watching;	/* hot reload thread is running   */
+static pthread_t       image_tid;	/* world image writer thread id   */
+static int32_t         image_writing;	/* world image writer is running  */
+static int32_t         image_stop;	/* world image writer should quit */
+static uint64_t        image_signature; /* world_signature () at build  */
+static uint32_t        room_moves[N_ROOMS][3]; /* moves: left/enter/right */
 
 
 /* 
@@ -458,12 +719,14 @@ static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
 static void
 do_photo_swap (room_t* r, int32_t which)
 {
-    photo_t* tmp;	/* temporary variable to help with swap */
+    photo_slot_t* tmp;	/* temporary variable to help with swap */
 
-    /* Swap the photos. */
+    /* Swap the photos (the prefetch thread looks at room views). */
+    (void)pthread_mutex_lock (&slot_lock);
     tmp               = r->view;
     r->view           = swap_photo[which];
     swap_photo[which] = tmp;
+    (void)pthread_mutex_unlock (&slot_lock);
 }
 
 
@@ -519,10 +782,15 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
     o->x = x;
     o->y = y;
 
-    /* Now add the object to the new room's contents. */
+    /* Now add the object to the new room's contents and bands. */
     o->loc = r;
     o->next = r->contents;
     r->contents = o;
+    if (NULL == r->row_band) {
+        alloc_bands (r);
+    }
+    band_insert (r->row_band, y, image_height (o->img), o);
+    band_insert (r->col_band, x, image_width (o->img), o);
 }
 
 
@@ -548,11 +816,11 @@ insert_object (object_t* o, room_t* r)
 
 
     /* Choose a random x location. */
-    range = photo_width (r->view) - image_width (o->img);
+    range = room_photo_width (r) - image_width (o->img);
     xpos = (0 >= range ? 0 : (rand () % range));
 
     /* Place in the lowest quarter of the roo photo if the object fits... */
-    space = photo_height (r->view);
+    space = room_photo_height (r);
     img_ht = image_height (o->img);
     range = space / 4 - img_ht;
     if (0 >= range) {
@@ -706,6 +974,8 @@ remove_object (object_t* o)
 		break;
 	    }
 	}
+	band_remove (o->loc->row_band, o->y, image_height (o->img), o);
+	band_remove (o->loc->col_band, o->x, image_width (o->img), o);
 
 	/* Mark the object's location as NULL. */
 	o->loc = NULL;
@@ -713,6 +983,148 @@ remove_object (object_t* o)
 }
 
 
+/* 
+ * alloc_bands
+ *   DESCRIPTION: Allocate a room's (empty) bands of rows and of columns,
+ *                ROOM_BANDS of each, in one block.
+ *   INPUTS: r -- the room, which has no bands yet
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: allocates memory; ends the program if no memory is
+ *                 available
+ */
+static void
+alloc_bands (room_t* r)
+{
+    if (NULL == (r->row_band = calloc (2 * ROOM_BANDS, 
+                                       sizeof (r->row_band[0])))) {
+        PANIC ("out of memory");
+    }
+    r->col_band = r->row_band + ROOM_BANDS;
+}
+
+
+/* 
+ * band_insert
+ *   DESCRIPTION: Add an object to the bands covering a range of rows (or
+ *                columns) of a room, ahead of the objects already there,
+ *                as it is added to the head of the room's contents.  
+ *                Its position and image are copied into the bands, so
+ *                it must be taken out and put back in to move it.
+ *   INPUTS: band -- the room's bands of rows (or columns)
+ *           first -- first row (or column) covered by the object
+ *           len -- number of rows (or columns) covered
+ *           o -- the object
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may allocate memory; ends the program if no memory 
+ *                 is available
+ */
+static void
+band_insert (obj_band_t* band, int32_t first, int32_t len, object_t* o)
+{
+    obj_band_t* b;	 /* band covered by the object  */
+    obj_band_t  grown;	 /* band's arrays, with space   */
+    int32_t     idx;	 /* index over bands covered    */
+    int32_t     num;	 /* number of bands covered     */
+
+    num = ((first + len - 1) >> ROOM_BAND_SHIFT) - (first >> ROOM_BAND_SHIFT);
+    for (idx = 0; num >= idx && ROOM_BANDS > idx; idx++) {
+        b = &band[((first >> ROOM_BAND_SHIFT) + idx) % ROOM_BANDS];
+
+	/* Make room for one more object, moving the arrays if need be. */
+	if (b->num == b->cap) {
+	    grown.cap = 2 * b->cap + 4;
+	    if (NULL == (grown.obj = malloc (grown.cap * 
+					     (sizeof (grown.obj[0]) +
+					      sizeof (grown.img[0]) +
+					      4 * sizeof (grown.x[0]))))) {
+	        PANIC ("out of memory");
+	    }
+	    grown.img = (image_t**)(grown.obj + grown.cap);
+	    grown.x = (uint16_t*)(grown.img + grown.cap);
+	    grown.y = grown.x + grown.cap;
+	    grown.width = grown.y + grown.cap;
+	    grown.height = grown.width + grown.cap;
+	    grown.num = b->num;
+	    if (0 < b->num) {
+		(void)memcpy (grown.obj, b->obj, b->num * sizeof (b->obj[0]));
+		(void)memcpy (grown.img, b->img, b->num * sizeof (b->img[0]));
+		(void)memcpy (grown.x, b->x, b->num * sizeof (b->x[0]));
+		(void)memcpy (grown.y, b->y, b->num * sizeof (b->y[0]));
+		(void)memcpy (grown.width, b->width, 
+			      b->num * sizeof (b->width[0]));
+		(void)memcpy (grown.height, b->height, 
+			      b->num * sizeof (b->height[0]));
+	    }
+	    free (b->obj);
+	    *b = grown;
+	}
+
+	/* Put the object first, as it is drawn first. */
+	(void)memmove (b->obj + 1, b->obj, b->num * sizeof (b->obj[0]));
+	(void)memmove (b->img + 1, b->img, b->num * sizeof (b->img[0]));
+	(void)memmove (b->x + 1, b->x, b->num * sizeof (b->x[0]));
+	(void)memmove (b->y + 1, b->y, b->num * sizeof (b->y[0]));
+	(void)memmove (b->width + 1, b->width, b->num * sizeof (b->width[0]));
+	(void)memmove (b->height + 1, b->height, 
+		       b->num * sizeof (b->height[0]));
+	b->obj[0] = o;
+	b->img[0] = o->img;
+	b->x[0] = o->x;
+	b->y[0] = o->y;
+	b->width[0] = image_width (o->img);
+	b->height[0] = image_height (o->img);
+	b->num++;
+    }
+}
+
+
+/* 
+ * band_remove
+ *   DESCRIPTION: Take an object out of the bands covering a range of 
+ *                rows (or columns) of a room.
+ *   INPUTS: band -- the room's bands of rows (or columns)
+ *           first -- first row (or column) covered by the object
+ *           len -- number of rows (or columns) covered
+ *           o -- the object
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+band_remove (obj_band_t* band, int32_t first, int32_t len, const object_t* o)
+{
+    obj_band_t* b;	 /* band covered by the object  */
+    int32_t     idx;	 /* index over bands covered    */
+    int32_t     num;	 /* number of bands covered     */
+    int32_t     pos;	 /* index over objects in band  */
+
+    num = ((first + len - 1) >> ROOM_BAND_SHIFT) - (first >> ROOM_BAND_SHIFT);
+    for (idx = 0; num >= idx && ROOM_BANDS > idx; idx++) {
+        b = &band[((first >> ROOM_BAND_SHIFT) + idx) % ROOM_BANDS];
+	for (pos = 0; b->num > pos && o != b->obj[pos]; pos++) {
+	}
+	if (b->num == pos) {
+	    continue;
+	}
+	b->num--;
+	(void)memmove (b->obj + pos, b->obj + pos + 1, 
+		       (b->num - pos) * sizeof (b->obj[0]));
+	(void)memmove (b->img + pos, b->img + pos + 1, 
+		       (b->num - pos) * sizeof (b->img[0]));
+	(void)memmove (b->x + pos, b->x + pos + 1, 
+		       (b->num - pos) * sizeof (b->x[0]));
+	(void)memmove (b->y + pos, b->y + pos + 1, 
+		       (b->num - pos) * sizeof (b->y[0]));
+	(void)memmove (b->width + pos, b->width + pos + 1, 
+		       (b->num - pos) * sizeof (b->width[0]));
+	(void)memmove (b->height + pos, b->height + pos + 1, 
+		       (b->num - pos) * sizeof (b->height[0]));
+    }
+}
+
+
 /* 
  * obj_get_x
  *   DESCRIPTION: Get x position of object within containing room.
@@ -791,6 +1203,68 @@ room_contents_iterate (const room_t* r)
 }
 
 
+/* 
+ * room_objects_on_row
+ *   DESCRIPTION: Find the objects in a room that may cover part of a row
+ *                of its photo, in the order in which they are drawn.  
+ *                All objects covering the row are included, but some 
+ *                others may be too.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the row
+ *   OUTPUTS: list -- the objects (valid until objects next move)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+room_objects_on_row (const room_t* r, int32_t y, obj_list_t* list)
+{
+    const obj_band_t* b; /* band holding the row */
+
+    if (0 > y || NULL == r->row_band) {
+        list->num = 0;
+	return;
+    }
+    b = &r->row_band[(y >> ROOM_BAND_SHIFT) % ROOM_BANDS];
+    list->num = b->num;
+    list->x = b->x;
+    list->y = b->y;
+    list->width = b->width;
+    list->height = b->height;
+    list->img = b->img;
+}
+
+
+/* 
+ * room_objects_on_column
+ *   DESCRIPTION: Find the objects in a room that may cover part of a 
+ *                column of its photo, in the order in which they are 
+ *                drawn.  All objects covering the column are included,
+ *                but some others may be too.
+ *   INPUTS: r -- pointer to the room
+ *           x -- the column
+ *   OUTPUTS: list -- the objects (valid until objects next move)
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+room_objects_on_column (const room_t* r, int32_t x, obj_list_t* list)
+{
+    const obj_band_t* b; /* band holding the column */
+
+    if (0 > x || NULL == r->col_band) {
+        list->num = 0;
+	return;
+    }
+    b = &r->col_band[(x >> ROOM_BAND_SHIFT) % ROOM_BANDS];
+    list->num = b->num;
+    list->x = b->x;
+    list->y = b->y;
+    list->width = b->width;
+    list->height = b->height;
+    list->img = b->img;
+}
+
+
 /* 
  * room_name
  *   DESCRIPTION: Get name for a room.
@@ -808,16 +1282,58 @@ room_name (const room_t* r)
 
 /* 
  * room_photo
- *   DESCRIPTION: Get room photo for a room.
+ *   DESCRIPTION: Get room photo for a room, reading it in if it is not
+ *                in memory (or waiting for the prefetch thread to finish
+ *                reading it in).  The photo remains valid until the next
+ *                call.  When the room differs from that of the last 
+ *                call, the move is counted and the prefetch thread is
+ *                woken to read in the photos of the room's neighbors.
+ *                Must always be called from the same thread (the one 
+ *                that draws).
  *   INPUTS: r -- pointer to the room
  *   OUTPUTS: none
  *   RETURN VALUE: a pointer to room r's photo
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may read in a photo and free others; ends the 
+ *                 program if the photo can no longer be read
  */
 photo_t*
 room_photo (const room_t* r)
 {
-    return r->view;
+    photo_t*      p;		/* the photo                */
+    photo_t*      to_free[N_ROOMS + N_SWAPS]; /* photos thrown out */
+    int32_t       num_free;	/* number of photos to free */
+    photo_slot_t* s;		/* slot holding the photo   */
+
+    (void)pthread_mutex_lock (&slot_lock);
+    if (shown_room != r) {
+        if (NULL != shown_room) {
+	    count_move (shown_room, r);
+	}
+        shown_room = prefetch_room = r;
+	(void)pthread_cond_broadcast (&prefetch_wake);
+    }
+    cur_slot = s = r->view;
+    s->last_used = ++slot_clock;
+    while (NULL == (p = s->photo)) {
+        if (s->loading) {
+	    (void)pthread_cond_wait (&slot_loaded, &slot_lock);
+	} else if (NULL == load_slot (s)) {
+	    (void)pthread_mutex_unlock (&slot_lock);
+	    fprintf (stderr, "Can't read room photo %s.\n", s->filename);
+	    PANIC ("can't read room photo");
+	}
+    }
+    num_free = num_evicted;
+    if (0 < num_free) {
+	(void)memcpy (to_free, evicted, num_free * sizeof (evicted[0]));
+	num_evicted = 0;
+    }
+    (void)pthread_mutex_unlock (&slot_lock);
+
+    while (0 < num_free) {
+        free_photo (to_free[--num_free]);
+    }
+    return p;
 }
 
 
@@ -832,7 +1348,7 @@ room_photo (const room_t* r)
 uint32_t 
 room_photo_height (const room_t* r)
 {
-    return photo_height (r->view);
+    return r->view->hdr.height;
 }
 
 
@@ -847,25 +1363,839 @@ room_photo_height (const room_t* r)
 uint32_t 
 room_photo_width (const room_t* r)
 {
-    return photo_width (r->view);
+    return r->view->hdr.width;
+}
+
+
+/* 
+ * asset_worker
+ *   DESCRIPTION: Take tasks from a pool and read in their files until 
+ *                no tasks are left.
+ *   INPUTS: arg -- the pool (an asset_pool_t*)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in the result of each task taken
+ */
+static void*
+asset_worker (void* arg)
+{
+    asset_pool_t* pool = arg;	/* the pool      */
+    asset_task_t* t;		/* task taken    */
+
+    while (1) {
+	(void)pthread_mutex_lock (&pool->lock);
+	t = (pool->num_tasks > pool->next ? &pool->task[pool->next++] : NULL);
+	(void)pthread_mutex_unlock (&pool->lock);
+	if (NULL == t) {
+	    return NULL;
+	}
+	if (NULL != t->slot) {
+	    t->ok = (0 == read_photo_header (t->filename, &t->slot->hdr));
+	} else {
+	    t->ok = (NULL != (t->img = read_obj_image (t->filename)));
+	}
+    }
+}
+
+
+/* 
+ * load_assets
+ *   DESCRIPTION: Read in the files for a set of tasks, using a pool of
+ *                threads so that reading and quantizing files overlap.
+ *                The calling thread works too, so all tasks are done
+ *                even if no other thread can be started.
+ *   INPUTS: task -- the tasks
+ *           num_tasks -- number of tasks
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in the result of each task
+ */
+static void
+load_assets (asset_task_t* task, int32_t num_tasks)
+{
+    asset_pool_t pool;			/* tasks to be handed out    */
+    pthread_t    tid[BUILD_THREADS];	/* helper thread ids         */
+    int32_t      num_threads;		/* helper threads started    */
+    long         num_cpus;		/* number of processors      */
+    int32_t      idx;			/* index over helper threads */
+
+    pool.task = task;
+    pool.num_tasks = num_tasks;
+    pool.next = 0;
+    (void)pthread_mutex_init (&pool.lock, NULL);
+
+    num_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    for (num_threads = 0; 
+	 BUILD_THREADS - 1 > num_threads && num_cpus - 1 > num_threads &&
+	 num_tasks - 1 > num_threads &&
+	 0 == pthread_create (&tid[num_threads], NULL, asset_worker, &pool);
+	 num_threads++) {
+    }
+    (void)asset_worker (&pool);
+    for (idx = 0; num_threads > idx; idx++) {
+        (void)pthread_join (tid[idx], NULL);
+    }
+    (void)pthread_mutex_destroy (&pool.lock);
+}
+
+
+/* 
+ * load_slot
+ *   DESCRIPTION: Read in the photo for a slot (from the world image
+ *                if it is there), then throw out other photos as needed
+ *                to get back within the budget.  The lock is released 
+ *                while reading.  Call with slot_lock
+ *                held.
+ *   INPUTS: s -- the slot (not already loading)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo, or NULL if it could not be read
+ *   SIDE EFFECTS: wakes threads waiting for photos to be read in
+ */
+static photo_t*
+load_slot (photo_slot_t* s)
+{
+    photo_t*    p = NULL;  /* the photo read in          */
+    const void* saved;	   /* photo in world image       */
+    size_t      saved_len; /* length of photo in image   */
+
+    s->loading = 1;
+    saved = s->saved;
+    saved_len = s->saved_len;
+    (void)pthread_mutex_unlock (&slot_lock);
+    if (NULL == saved || NULL == (p = restore_photo (saved, saved_len))) {
+        p = read_photo (s->filename);
+    }
+    (void)pthread_mutex_lock (&slot_lock);
+    s->loading = 0;
+    if (NULL != p) {
+        s->photo = p;
+        s->bytes = photo_memory (p);
+	s->last_used = ++slot_clock;
+	slot_bytes += s->bytes;
+	evict_photos ();
+    }
+    (void)pthread_cond_broadcast (&slot_loaded);
+    return p;
+}
+
+
+/* 
+ * evict_photos
+ *   DESCRIPTION: Throw out photos, least recently used first, until the
+ *                photos in memory fit in the budget.  The current slot
+ *                and photos being saved are never thrown out.  Photos thrown out are left for 
+ *                room_photo to free (if too many are waiting to be 
+ *                freed, the budget is exceeded for a while instead).
+ *                Call with slot_lock held.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: empties slots
+ */
+static void
+evict_photos ()
+{
+    photo_slot_t* lru;	/* least recently used slot */
+    int32_t       idx;	/* index over slots         */
+
+    while (slot_budget < slot_bytes && N_ROOMS + N_SWAPS > num_evicted) {
+	lru = NULL;
+        for (idx = 0; N_ROOMS + N_SWAPS > idx; idx++) {
+	    if (NULL != photo_slot[idx].photo && cur_slot != &photo_slot[idx] &&
+	        !photo_slot[idx].saving && (NULL == lru || 
+		 lru->last_used - photo_slot[idx].last_used < UINT32_MAX / 2)) {
+	        lru = &photo_slot[idx];
+	    }
+	}
+	if (NULL == lru) {
+	    return;
+	}
+	evicted[num_evicted++] = lru->photo;
+	lru->photo = NULL;
+	slot_bytes -= lru->bytes;
+    }
+}
+
+
+/* 
+ * count_move
+ *   DESCRIPTION: Count a move of the player from one room to the next,
+ *                if the rooms are neighbors.  Call with slot_lock held.
+ *   INPUTS: from -- the room left
+ *           to -- the room entered
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: updates room_moves
+ */
+static void
+count_move (const room_t* from, const room_t* to)
+{
+    if (from->left == to) {
+        room_moves[from - room][0]++;
+    } else if (from->enter == to) {
+        room_moves[from - room][1]++;
+    } else if (from->right == to) {
+        room_moves[from - room][2]++;
+    }
+}
+
+
+/* 
+ * prefetch_neighbors
+ *   DESCRIPTION: Prefetch thread: each time room_photo moves to a new
+ *                room, read in the photos of the rooms next to it, in 
+ *                order of the number of times the player has moved from
+ *                the room into each of them.  Start over whenever the 
+ *                player moves on.
+ *   INPUTS: arg -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: reads in photos
+ */
+static void*
+prefetch_neighbors (void* arg)
+{
+    const room_t* r;		/* room to prefetch around     */
+    room_t*       next[3];	/* r's neighbors, best first   */
+    uint32_t      moves[3];	/* moves into each neighbor    */
+    photo_slot_t* s;		/* neighbor's photo            */
+    room_t*       t_room;	/* temporary for sorting       */
+    uint32_t      t_moves;	/* temporary for sorting       */
+    int32_t       i, j;		/* indices over neighbors      */
+
+    (void)pthread_mutex_lock (&slot_lock);
+    while (1) {
+        while (NULL == prefetch_room) {
+	    (void)pthread_cond_wait (&prefetch_wake, &slot_lock);
+	}
+	r = prefetch_room;
+	prefetch_room = NULL;
+	next[0] = r->left;
+	next[1] = r->enter;
+	next[2] = r->right;
+	for (i = 0; 3 > i; i++) {
+	    moves[i] = room_moves[r - room][i];
+	    for (j = i; 0 < j && moves[j - 1] < moves[j]; j--) {
+		t_room = next[j];
+		next[j] = next[j - 1];
+		next[j - 1] = t_room;
+		t_moves = moves[j];
+		moves[j] = moves[j - 1];
+		moves[j - 1] = t_moves;
+	    }
+	}
+	for (i = 0; 3 > i && NULL == prefetch_room; i++) {
+	    if (NULL != next[i] && NULL == (s = next[i]->view)->photo &&
+	        !s->loading) {
+	        (void)load_slot (s);
+	    }
+	}
+    }
+    return NULL;
+}
+
+
+/* 
+ * same_photo_file
+ *   DESCRIPTION: Check whether a file in a photo's directory holds the
+ *                photo, in any form: the names must match once the 
+ *                suffixes (".photo", ".qphoto", and so forth) are removed.
+ *   INPUTS: fname -- photo file name (perhaps with a directory)
+ *           name -- name of a file in the same directory
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the file holds the photo, or 0 if not
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+same_photo_file (const char* fname, const char* name)
+{
+    const char* base;	/* fname without directory    */
+    const char* dot;	/* suffix of base, if any     */
+    size_t      len;	/* length of base sans suffix */
+
+    base = (NULL == (base = strrchr (fname, '/')) ? fname : base + 1);
+    len = (NULL == (dot = strrchr (base, '.')) ? strlen (base) : dot - base);
+    return (0 == strncmp (base, name, len) && 
+	    ('\0' == name[len] || '.' == name[len]));
+}
+
+
+/* 
+ * watch_photos
+ *   DESCRIPTION: Hot reload thread: watch the directories holding the
+ *                room photos, and read in a photo again each time one of
+ *                its files is written or moved into place.  The new 
+ *                photo waits in its slot until the game loop swaps it 
+ *                in (see apply_photo_reloads); until then, later changes
+ *                to the same photo wait as well.
+ *   INPUTS: arg -- inotify file descriptor (cast to a pointer)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL if the descriptor can no longer be read
+ *   SIDE EFFECTS: reads in photos
+ */
+static void*
+watch_photos (void* arg)
+{
+    const struct inotify_event* ev;	/* event read                */
+    char     buf[4096] __attribute__ ((aligned (8))); /* events read */
+    int      fd = (intptr_t)arg;	/* inotify file descriptor   */
+    ssize_t  len;			/* bytes of events read      */
+    ssize_t  pos;			/* offset of event in buf    */
+    photo_t* p;				/* photo read in again       */
+    int32_t  idx;			/* index over slots          */
+
+    while (0 < (len = read (fd, buf, sizeof (buf)))) {
+	for (pos = 0; len > pos; pos += sizeof (*ev) + ev->len) {
+	    ev = (const struct inotify_event*)(buf + pos);
+	    for (idx = 0; 0 < ev->len && N_ROOMS + N_SWAPS > idx; idx++) {
+		if (ev->wd != photo_slot[idx].watch ||
+		    !same_photo_file (photo_slot[idx].filename, ev->name)) {
+		    continue;
+		}
+		(void)pthread_mutex_lock (&slot_lock);
+		while (NULL != photo_slot[idx].reloaded) {
+		    (void)pthread_cond_wait (&reload_taken, &slot_lock);
+		}
+		(void)pthread_mutex_unlock (&slot_lock);
+		if (NULL != (p = read_photo (photo_slot[idx].filename))) {
+		    (void)pthread_mutex_lock (&slot_lock);
+		    photo_slot[idx].reloaded = p;
+		    (void)pthread_mutex_unlock (&slot_lock);
+		}
+	    }
+	}
+    }
+    (void)close (fd);
+    return NULL;
+}
+
+
+/* 
+ * apply_photo_reloads
+ *   DESCRIPTION: Swap in the room photos read in again by the hot reload
+ *                thread, and free the photos thrown out since the last
+ *                call (room_photo, which also frees them, is only called
+ *                when a room is prepared).  Call from the game loop 
+ *                between ticks (from the thread that draws).  A photo 
+ *                still being read in by the prefetch thread is left for
+ *                a later call.
+ *   INPUTS: r -- the room shown on the screen
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if r's photo was replaced, in which case r should 
+ *                 be prepared and redrawn (its size may have changed),
+ *                 or 0 if not
+ *   SIDE EFFECTS: replaces and frees photos
+ */
+int32_t
+apply_photo_reloads (const room_t* r)
+{
+    photo_t*      to_free[2 * (N_ROOMS + N_SWAPS)]; /* old photos   */
+    int32_t       num_free = 0;	/* number of photos to free        */
+    int32_t       shown = 0;	/* r's photo was replaced          */
+    photo_slot_t* s;		/* slot with a photo to swap in    */
+    int32_t       idx;		/* index over slots                */
+
+    (void)pthread_mutex_lock (&slot_lock);
+    for (idx = 0; watching && N_ROOMS + N_SWAPS > idx; idx++) {
+	s = &photo_slot[idx];
+        if (NULL == s->reloaded || s->loading || s->saving) {
+	    continue;
+	}
+	if (NULL != s->photo) {
+	    to_free[num_free++] = s->photo;
+	    slot_bytes -= s->bytes;
+	}
+	s->photo = s->reloaded;
+	s->reloaded = NULL;
+	s->saved = NULL;
+	s->bytes = photo_memory (s->photo);
+	s->hdr.width = photo_width (s->photo);
+	s->hdr.height = photo_height (s->photo);
+	s->last_used = ++slot_clock;
+	slot_bytes += s->bytes;
+	shown |= (r->view == s);
+    }
+    (void)pthread_cond_broadcast (&reload_taken);
+    evict_photos ();
+    (void)memcpy (to_free + num_free, evicted, 
+    		  num_evicted * sizeof (evicted[0]));
+    num_free += num_evicted;
+    num_evicted = 0;
+    (void)pthread_mutex_unlock (&slot_lock);
+
+    while (0 < num_free) {
+        free_photo (to_free[--num_free]);
+    }
+    return shown;
+}
+
+
+/* 
+ * sign_data
+ *   DESCRIPTION: Add a block of data to a signature.
+ *   INPUTS: sig -- signature so far
+ *           buf -- the data
+ *           len -- length of the data in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new signature
+ *   SIDE EFFECTS: none
+ */
+static uint64_t
+sign_data (uint64_t sig, const void* buf, size_t len)
+{
+    return (sig ^ photo_hash (buf, len)) * 1099511628211ULL;
+}
+
+
+/* 
+ * sign_file
+ *   DESCRIPTION: Add the size and modification time of a file to a 
+ *                signature.  For a room photo, the same is done for its
+ *                precompiled photo (".qphoto" in place of ".photo"), 
+ *                which read_photo prefers if it is up to date.  Missing
+ *                files are signed as such.
+ *   INPUTS: sig -- signature so far
+ *           fname -- file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new signature
+ *   SIDE EFFECTS: none
+ */
+static uint64_t
+sign_file (uint64_t sig, const char* fname)
+{
+    struct stat st;		/* file status                  */
+    int64_t     stamp[3];	/* file size and time modified  */
+    char        qname[1024];	/* name of precompiled photo    */
+    size_t      len;		/* length of file name          */
+
+    stamp[0] = stamp[1] = stamp[2] = -1;
+    if (0 == stat (fname, &st)) {
+        stamp[0] = st.st_size;
+	stamp[1] = st.st_mtim.tv_sec;
+	stamp[2] = st.st_mtim.tv_nsec;
+    }
+    sig = sign_data (sig, stamp, sizeof (stamp));
+    len = strlen (fname);
+    if (6 <= len && 0 == strcmp (fname + len - 6, ".photo") &&
+        sizeof (qname) > (size_t)snprintf (qname, sizeof (qname), "%.*s%s", 
+					    (int)(len - 6), fname, 
+					    QPHOTO_SUFFIX)) {
+        sig = sign_file (sig, qname);
+    }
+    return sig;
+}
+
+
+/* 
+ * world_signature
+ *   DESCRIPTION: Compute the signature of everything that goes into a
+ *                world image: the room, object, and swap tables, the 
+ *                image files they name and the asset pack (by size and
+ *                modification time), and the quantizer used.  A world 
+ *                image with a different signature is out of date.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the signature
+ *   SIDE EFFECTS: none
+ */
+static uint64_t
+world_signature ()
+{
+    int32_t     field[6];	/* numeric fields of an entry */
+    const char* pack;		/* asset pack file name       */
+    uint64_t    sig;		/* signature so far           */
+    int32_t     idx;		/* index over data arrays     */
+
+    field[0] = WORLD_IMAGE_VERSION;
+    field[1] = QUANTIZER_VERSION;
+    field[2] = default_quantizer ();
+    field[3] = N_ROOMS;
+    field[4] = N_OBJECTS;
+    field[5] = N_SWAPS;
+    sig = sign_data (0, field, sizeof (field));
+    for (idx = 0; N_ROOMS > idx; idx++) {
+        field[0] = room_data[idx].id;
+        field[1] = room_data[idx].left;
+        field[2] = room_data[idx].enter;
+        field[3] = room_data[idx].right;
+	sig = sign_data (sig, field, 4 * sizeof (field[0]));
+	sig = sign_data (sig, room_data[idx].name, 
+			 strlen (room_data[idx].name) + 1);
+	sig = sign_data (sig, room_data[idx].filename, 
+			 strlen (room_data[idx].filename) + 1);
+	sig = sign_file (sig, room_data[idx].filename);
+    }
+    for (idx = 0; N_OBJECTS > idx; idx++) {
+        field[0] = obj_data[idx].id;
+        field[1] = obj_data[idx].room;
+        field[2] = obj_data[idx].x;
+        field[3] = obj_data[idx].y;
+	sig = sign_data (sig, field, 4 * sizeof (field[0]));
+	sig = sign_data (sig, obj_data[idx].name, 
+			 strlen (obj_data[idx].name) + 1);
+	sig = sign_data (sig, obj_data[idx].filename, 
+			 strlen (obj_data[idx].filename) + 1);
+	sig = sign_file (sig, obj_data[idx].filename);
+    }
+    for (idx = 0; N_SWAPS > idx; idx++) {
+        field[0] = swap_data[idx].id;
+	sig = sign_data (sig, field, sizeof (field[0]));
+	sig = sign_data (sig, swap_data[idx].filename, 
+			 strlen (swap_data[idx].filename) + 1);
+	sig = sign_file (sig, swap_data[idx].filename);
+    }
+    if (NULL == (pack = getenv (ASSET_PACK_ENV))) {
+        pack = ASSET_PACK_FILE;
+    }
+    sig = sign_data (sig, pack, strlen (pack) + 1);
+    return sign_file (sig, pack);
+}
+
+
+/* 
+ * world_image_name
+ *   DESCRIPTION: Find the name of the world image file.
+ *   INPUTS: len -- size of fname buffer in bytes
+ *   OUTPUTS: fname -- world image file name
+ *   RETURN VALUE: 0 on success, or -1 if the world image is off or the
+ *                 name does not fit
+ *   SIDE EFFECTS: may create the photo cache directory
+ */
+static int32_t
+world_image_name (char* fname, size_t len)
+{
+    const char* name; /* name from environment */
+    const char* dir;  /* photo cache directory */
+    int         n;    /* length of name        */
+
+    if (NULL != (name = getenv (WORLD_IMAGE_ENV))) {
+        n = snprintf (fname, len, "%s", name);
+    } else if (NULL != (dir = photo_cache_dir ())) {
+        n = snprintf (fname, len, "%s/%s", dir, WORLD_IMAGE_FILE);
+    } else {
+        return -1;
+    }
+    return ((0 >= n || (size_t)n >= len) ? -1 : 0);
+}
+
+
+/* 
+ * restore_world_image
+ *   DESCRIPTION: Do the tasks of reading in the image files from an up
+ *                to date world image instead, if there is one.  The 
+ *                image is mapped and left mapped until the program ends;
+ *                object images are used in place, and room photos are 
+ *                restored from it when needed (see load_slot).  Only the
+ *                pointers to the data are set up, so the work done is
+ *                proportional to the number of rooms and objects, not to
+ *                the amount of data.  Any object image that cannot be 
+ *                restored is read from its file.  The image must carry
+ *                image_signature, taken by build_world before the 
+ *                files are looked at.
+ *   INPUTS: task -- the tasks (as set up by build_world)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the tasks were done, or -1 if there is no world 
+ *                 image or it is out of date or damaged
+ *   SIDE EFFECTS: fills in the result of each task; maps the image
+ */
+static int32_t
+restore_world_image (asset_task_t* task)
+{
+    char                 fname[1024]; /* world image file name   */
+    const world_image_t* wi;	/* world image header            */
+    const world_entry_t* e;	/* entry for a task              */
+    struct stat          st;	/* world image file status       */
+    const uint8_t*       base;	/* start of world image mapping  */
+    int                  fd;	/* world image file descriptor   */
+    int32_t              ok;	/* image is usable               */
+    int32_t              idx;	/* index over tasks              */
+
+    if (0 != world_image_name (fname, sizeof (fname)) || 
+        -1 == (fd = open (fname, O_RDONLY))) {
+        return -1;
+    }
+    if (0 != fstat (fd, &st) || sizeof (*wi) > (size_t)st.st_size ||
+	MAP_FAILED == (base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED,
+				    fd, 0))) {
+        (void)close (fd);
+	return -1;
+    }
+    (void)close (fd);
+
+    /* Check that the image is up to date and its entries lie within it. */
+    wi = (const world_image_t*)base;
+    ok = (0 == memcmp (wi->magic, WORLD_IMAGE_MAGIC, sizeof (wi->magic)) &&
+	  WORLD_IMAGE_VERSION == wi->version &&
+	  image_signature == wi->signature);
+    for (idx = 0; ok && N_ROOMS + N_SWAPS > idx; idx++) {
+	e = &wi->photo[idx];
+        ok = (e->offset <= (uint64_t)st.st_size && 
+	      e->length <= (uint64_t)st.st_size - e->offset);
+    }
+    for (idx = 0; ok && N_OBJECTS > idx; idx++) {
+	e = &wi->obj[idx];
+        ok = (e->offset <= (uint64_t)st.st_size && 
+	      e->length <= (uint64_t)st.st_size - e->offset);
+    }
+    if (!ok) {
+        (void)munmap ((void*)base, st.st_size);
+	return -1;
+    }
+
+    /* Point the tasks at the saved data. */
+    for (idx = 0; N_ROOMS + N_OBJECTS + N_SWAPS > idx; idx++) {
+        if (NULL != task[idx].slot) {
+	    e = &wi->photo[task[idx].slot - photo_slot];
+	    task[idx].slot->hdr = e->hdr;
+	    if (0 != e->length) {
+		task[idx].slot->saved = base + e->offset;
+		task[idx].slot->saved_len = e->length;
+	    }
+	    task[idx].ok = 1;
+	} else {
+	    e = &wi->obj[idx - N_ROOMS];
+	    if (0 == e->length ||
+		NULL == (task[idx].img = restore_obj_image (base + e->offset,
+							    e->length))) {
+	        task[idx].img = read_obj_image (task[idx].filename);
+	    }
+	    task[idx].ok = (NULL != task[idx].img);
+	}
+    }
+    return 0;
+}
+
+
+/* 
+ * write_world_image
+ *   DESCRIPTION: World image writer thread: once the first room has 
+ *                been drawn, save the room photos and object images into
+ *                a new world image (see world_image_t), so that writing
+ *                it never delays the start of the game.  A photo already
+ *                in memory is saved from its slot (and kept there until
+ *                it has been saved); any other photo is read in, saved,
+ *                and freed, counting against the memory budget for 
+ *                photos while it is in memory, so the photos need not
+ *                all fit in memory at once.  The image is 
+ *                written to a temporary file that is then renamed into 
+ *                place, so a partial image is never used.  Failures are
+ *                ignored: the world will just be built from the files 
+ *                next time.  The thread gives up between entries when 
+ *                told to stop (see release_world).
+ *   INPUTS: arg -- ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: writes the world image file; reads in photos
+ */
+static void*
+write_world_image (void* arg)
+{
+    static const uint8_t zeros[QPHOTO_ALIGN];
+    world_image_t        wi;	      /* world image header          */
+    world_entry_t*       e;	      /* entry being written         */
+    char                 fname[1024]; /* world image file name       */
+    char                 tname[1024]; /* temporary file name         */
+    FILE*                out;	      /* temporary file              */
+    photo_slot_t*        s;	      /* slot of photo being saved   */
+    photo_t*             p;	      /* room photo being saved      */
+    int32_t              pinned;      /* p is pinned in its slot     */
+    size_t               bytes;	      /* memory used by p if read    */
+    off_t                pos;	      /* file offset                 */
+    off_t                start;	      /* aligned offset of entry     */
+    int32_t              written;     /* all writes have succeeded   */
+    int32_t              idx;	      /* index over entries          */
+
+    /* Wait for the first room to be drawn. */
+    (void)pthread_mutex_lock (&slot_lock);
+    while (NULL == shown_room && !image_stop) {
+        (void)pthread_cond_wait (&prefetch_wake, &slot_lock);
+    }
+    written = !image_stop;
+    (void)pthread_mutex_unlock (&slot_lock);
+
+    if (!written || 0 != world_image_name (fname, sizeof (fname)) ||
+        sizeof (tname) <= (size_t)snprintf (tname, sizeof (tname), 
+					     "%s.%d.tmp", fname, getpid ()) ||
+        NULL == (out = fopen (tname, "wb"))) {
+        return NULL;
+    }
+    (void)memset (&wi, 0, sizeof (wi));
+    (void)memcpy (wi.magic, WORLD_IMAGE_MAGIC, sizeof (wi.magic));
+    wi.version = WORLD_IMAGE_VERSION;
+    wi.signature = image_signature;
+    written = (1 == fwrite (&wi, sizeof (wi), 1, out));
+
+    /* Save the room photos, each starting on a page boundary. */
+    for (idx = 0; written && N_ROOMS + N_SWAPS > idx; idx++) {
+	s = &photo_slot[idx];
+	e = &wi.photo[idx];
+	pos = ftello (out);
+	start = (pos + QPHOTO_ALIGN - 1) & ~(off_t)(QPHOTO_ALIGN - 1);
+	written = (0 <= pos && 
+		   (pos == start || 1 == fwrite (zeros, start - pos, 1, out)));
+
+	/* Use the photo in memory if there is one. */
+	(void)pthread_mutex_lock (&slot_lock);
+	written = (written && !image_stop);
+	e->hdr = s->hdr;
+	pinned = (written && NULL != (p = s->photo) && !s->loading);
+	s->saving = pinned;
+	(void)pthread_mutex_unlock (&slot_lock);
+	if (!pinned && written && NULL != (p = read_photo (s->filename))) {
+	    bytes = photo_memory (p);
+	    (void)pthread_mutex_lock (&slot_lock);
+	    slot_bytes += bytes;
+	    evict_photos ();
+	    (void)pthread_mutex_unlock (&slot_lock);
+	} else if (!pinned) {
+	    p = NULL;
+	}
+
+	if (NULL != p) {
+	    if (0 == save_photo (out, p)) {
+	        e->offset = start;
+		e->length = ftello (out) - start;
+	    } else {
+	        written = (start == ftello (out));
+	    }
+	}
+
+	/* 
+	 * Unpin the photo, or free the one read in here (it was never in
+	 * a slot or drawn, so it is not the drawing thread's to free).
+	 */
+	(void)pthread_mutex_lock (&slot_lock);
+	if (pinned) {
+	    s->saving = 0;
+	    evict_photos ();
+	} else if (NULL != p) {
+	    slot_bytes -= bytes;
+	}
+	(void)pthread_mutex_unlock (&slot_lock);
+	if (!pinned && NULL != p) {
+	    free_unshown_photo (p);
+	}
+    }
+
+    /* Save the object images. */
+    for (idx = 0; written && N_OBJECTS > idx; idx++) {
+	e = &wi.obj[idx];
+	pos = ftello (out);
+	start = (pos + ARENA_ALIGN - 1) & ~(off_t)(ARENA_ALIGN - 1);
+	written = (0 <= pos && 
+		   (pos == start || 1 == fwrite (zeros, start - pos, 1, out)) &&
+		   0 == save_obj_image (out, object[obj_data[idx].id].img));
+	e->offset = start;
+	e->length = ftello (out) - start;
+    }
+
+    /* Fill in the header now that the entries are known. */
+    (void)pthread_mutex_lock (&slot_lock);
+    written = (written && !image_stop);
+    (void)pthread_mutex_unlock (&slot_lock);
+    written = (written && 0 == fseeko (out, 0, SEEK_SET) &&
+	       1 == fwrite (&wi, sizeof (wi), 1, out));
+    if (EOF == fclose (out) || !written || 0 != rename (tname, fname)) {
+        (void)unlink (tname);
+    }
+    return NULL;
+}
+
+
+/* 
+ * release_world
+ *   DESCRIPTION: Stop the world image writer, if it is running, and wait
+ *                for it to finish (it gives up on an unfinished image).
+ *                Call before releasing the asset arena.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: joins the world image writer thread
+ */
+void
+release_world ()
+{
+    if (!image_writing) {
+        return;
+    }
+    (void)pthread_mutex_lock (&slot_lock);
+    image_stop = 1;
+    (void)pthread_cond_broadcast (&prefetch_wake);
+    (void)pthread_mutex_unlock (&slot_lock);
+    (void)pthread_join (image_tid, NULL);
+    image_writing = 0;
 }
 
 
 /* 
  * build_world
  *   DESCRIPTION: Builds and connects the rooms, creates objects, and 
- *                reads in all image data (could be done lazily with 
- *                caching instead).
+ *                reads in the object images.  Room photos are only 
+ *                checked and their sizes read; the photos themselves are
+ *                read in when needed (see room_photo).  The image files
+ *                are all read first, in parallel (see load_assets); the
+ *                data are then checked and the world set up in order, 
+ *                so errors are found and reported just as if the files
+ *                had been read one at a time.  If the world image is up
+ *                to date, the files are not read at all; otherwise a 
+ *                thread is started to save a new world image once the
+ *                first room has been drawn (see write_world_image).
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: 1 on success, or 0 on failure
- *   SIDE EFFECTS: prints error messages to stderr on failure
+ *   SIDE EFFECTS: prints error messages to stderr on failure; may start
+ *                 the prefetch and world image writer threads; may map
+ *                 the world image
  */
 int32_t
 build_world ()
 {
-    int32_t idx;	/* index over data arrays   */
-    int32_t which;	/* id for current data item */
+    asset_task_t task[N_ROOMS + N_OBJECTS + N_SWAPS]; /* files to read */
+    pthread_t    tid;	/* prefetch/reload thread id */
+    const char*  env;	/* budget setting, if any   */
+    char         dir[1024]; /* directory of a photo */
+    const char*  slash;	/* end of photo's directory */
+    int          fd;	/* inotify file descriptor  */
+    int32_t      idx;	/* index over data arrays   */
+    int32_t      which;	/* id for current data item */
+    int32_t      restored; /* world image was used   */
+
+    /* Set up the photo slots and the memory budget for photos. */
+    (void)memset (photo_slot, 0, sizeof (photo_slot));
+    for (idx = 0; N_ROOMS > idx; idx++) {
+        photo_slot[idx].filename = room_data[idx].filename;
+    }
+    for (idx = 0; N_SWAPS > idx; idx++) {
+        photo_slot[N_ROOMS + idx].filename = swap_data[idx].filename;
+    }
+    slot_budget = (NULL != (env = getenv (ROOM_BUDGET_ENV)) ? 
+		   strtoul (env, NULL, 10) : ROOM_PHOTO_BUDGET);
+
+    /* 
+     * Read in all of the image files (only the sizes of photos), or 
+     * take them from the world image if it is up to date.
+     */
+    (void)memset (task, 0, sizeof (task));
+    for (idx = 0; N_ROOMS > idx; idx++) {
+        task[idx].filename = room_data[idx].filename;
+	task[idx].slot = &photo_slot[idx];
+    }
+    for (idx = 0; N_OBJECTS > idx; idx++) {
+        task[N_ROOMS + idx].filename = obj_data[idx].filename;
+    }
+    for (idx = 0; N_SWAPS > idx; idx++) {
+        task[N_ROOMS + N_OBJECTS + idx].filename = swap_data[idx].filename;
+	task[N_ROOMS + N_OBJECTS + idx].slot = &photo_slot[N_ROOMS + idx];
+    }
+    /* 
+     * Sign the inputs before anything is read, so that a world image 
+     * written later is out of date if any of them change meanwhile.
+     */
+    image_signature = world_signature ();
+    restored = (0 == restore_world_image (task));
+    if (!restored) {
+	load_assets (task, N_ROOMS + N_OBJECTS + N_SWAPS);
+    }
 
     /* Clear all accomplishment flags. */
     (void)memset (player_flags, 0, sizeof (player_flags));
@@ -891,8 +2221,8 @@ build_world ()
 
 	/* Set up the room. */
         room[which].name = room_data[idx].name;
-	room[which].view = read_photo (room_data[idx].filename);
-	if (NULL == room[which].view) {
+	room[which].view = &photo_slot[idx];
+	if (!task[idx].ok) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     room_data[idx].filename);
 	    return 0;
@@ -927,7 +2257,7 @@ build_world ()
 
 	/* Set up the object. */
         object[which].name = obj_data[idx].name;
-	object[which].img = read_obj_image (obj_data[idx].filename);
+	object[which].img = task[N_ROOMS + idx].img;
 	if (NULL == object[which].img) {
 	    fprintf (stderr, "Can't read object photo %s.\n", 
 	    	     obj_data[idx].filename);
@@ -968,15 +2298,50 @@ build_world ()
 	    return 0;
 	}
 
-	/* Read in the swap photo. */
-	swap_photo[which] = read_photo (swap_data[idx].filename);
-	if (NULL == swap_photo[which]) {
+	/* Set up the swap photo. */
+	swap_photo[which] = &photo_slot[N_ROOMS + idx];
+	if (!task[N_ROOMS + N_OBJECTS + idx].ok) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     swap_data[idx].filename);
 	    return 0;
 	}
     }
 
+    /* Save the world as built for the next run, once the game is up. */
+    if (!restored && !image_writing && 
+        0 == pthread_create (&image_tid, NULL, write_world_image, NULL)) {
+	image_writing = 1;
+    }
+
+    /* Start reading ahead around the rooms the player visits. */
+    if (ROOM_PREFETCH && !prefetching &&
+        0 == pthread_create (&tid, NULL, prefetch_neighbors, NULL)) {
+        (void)pthread_detach (tid);
+	prefetching = 1;
+    }
+
+    /* Watch the photos' directories for changes if asked to. */
+    if (!watching && NULL != (env = getenv (ROOM_RELOAD_ENV)) && 
+        0 == strcmp (env, "1") && 
+	-1 != (fd = inotify_init1 (IN_CLOEXEC))) {
+        for (idx = 0; N_ROOMS + N_SWAPS > idx; idx++) {
+	    slash = strrchr (photo_slot[idx].filename, '/');
+	    (void)snprintf (dir, sizeof (dir), "%.*s", 
+	    		    (NULL == slash ? 1 : 
+			     (int)(slash - photo_slot[idx].filename)),
+			    (NULL == slash ? "." : photo_slot[idx].filename));
+	    photo_slot[idx].watch = 
+	        inotify_add_watch (fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+	}
+	if (0 == pthread_create (&tid, NULL, watch_photos, 
+				 (void*)(intptr_t)fd)) {
+	    (void)pthread_detach (tid);
+	    watching = 1;
+	} else {
+	    (void)close (fd);
+	}
+    }
+
     /* Everything worked! */
     return 1;
 }
@@ -994,7 +2359,11 @@ build_world ()
 room_t*
 start_in_room ()
 {
+#if defined(STRESS_WORLD)
+    return &room[R_STRESS];
+#else
     return &room[R_EAST_EVRT];
+#endif
 }
 
 
@@ -39,6 +39,23 @@
 #include "types.h"
 
 
+/* 
+ * Objects in a room that may cover part of a line of its photo, in the
+ * order in which they are drawn (see room_objects_on_row), held as 
+ * parallel arrays so that those not covering the line can be skipped
+ * with a linear scan.  Object number i is at (x[i],y[i]) in the room
+ * and shows image img[i], which is width[i] by height[i] pixels.
+ */
+struct obj_list_t {
+    int32_t         num;	/* number of objects      */
+    const uint16_t* x;		/* x positions in room    */
+    const uint16_t* y;		/* y positions in room    */
+    const uint16_t* width;	/* image widths in pixels  */
+    const uint16_t* height;	/* image heights in pixels */
+    image_t* const* img;	/* images                 */
+};
+
+
 /* structure access functions */
 extern uint16_t obj_get_x (const object_t* obj);
 extern uint16_t obj_get_y (const object_t* obj);
@@ -50,9 +67,32 @@ extern photo_t* room_photo (const room_t* r);
 extern uint32_t room_photo_height (const room_t* r);
 extern uint32_t room_photo_width (const room_t* r);
 
+/* 
+ * Find the objects in a room that may cover part of a row (or column) 
+ * of its photo, in drawing order.
+ */
+extern void room_objects_on_row (const room_t* r, int32_t y, 
+				 obj_list_t* list);
+extern void room_objects_on_column (const room_t* r, int32_t x, 
+				    obj_list_t* list);
+
+/* 
+ * Swap in room photos changed on disk (in hot reload mode; see world.c)
+ * and free photos thrown out, between ticks; returns 1 if the photo of
+ * room r (on the screen) was replaced, so that r must be prepared and
+ * redrawn, or 0 if not.
+ */
+extern int32_t apply_photo_reloads (const room_t* r);
+
 /* Build the game world.  Returns 0 on failure, or 1 on success. */
 extern int32_t build_world (void);
 
+/* 
+ * Stop the threads started by build_world that must not outlive the 
+ * world's assets (call before arena_release).
+ */
+extern void release_world (void);
+
 /* Get pointer to starting room for player. */
 extern room_t* start_in_room (void);
 